@@ -0,0 +1,374 @@
+// Benchmarks building, emitting and checking a few fixed boards. Results are printed as JSON so
+// runs before and after a change can be compared.
+//
+// bench [--iterations N] [--filter substring] [--hotspots] [--trace trace.json]
+//
+// --hotspots writes the render cost hotspots of each board to stderr. --trace writes a Chrome
+// trace of the runs, which needs a build with -DSCAD_TRACE=ON. Built with -DSCAD_ALLOC_STATS=ON
+// the allocations are also broken down by category.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <glm/glm.hpp>
+#include <memory>
+#include <new>
+#include <string>
+#include <vector>
+
+#include "alloc_stats.h"
+#include "clearance.h"
+#include "interference.h"
+#include "key.h"
+#include "mesh.h"
+#include "plate.h"
+#include "render_cost.h"
+#include "scad.h"
+#include "trace.h"
+#include "transform.h"
+
+using namespace scad;
+
+// With SCAD_ALLOC_STATS util replaces operator new itself and the counts come from there.
+#ifndef SCAD_ALLOC_STATS_ENABLED
+
+namespace {
+
+std::atomic<int64_t> allocation_count(0);
+std::atomic<int64_t> allocated_bytes(0);
+
+}  // namespace
+
+void* operator new(size_t size) {
+  ++allocation_count;
+  allocated_bytes += size;
+  if (void* p = std::malloc(size == 0 ? 1 : size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  std::free(p);
+}
+
+#endif
+
+namespace {
+
+// Everything a workload makes besides its shape. Keys are allocated one by one so pointers to them
+// stay valid while the board is built.
+struct Board {
+  std::vector<std::unique_ptr<Key>> keys;
+  std::vector<Mesh> meshes;
+
+  Key& AddKey() {
+    keys.push_back(std::make_unique<Key>());
+    return *keys.back();
+  }
+
+  std::vector<const Key*> key_pointers() const {
+    std::vector<const Key*> pointers;
+    for (const auto& key : keys) {
+      pointers.push_back(key.get());
+    }
+    return pointers;
+  }
+};
+
+int64_t AllocationCount() {
+#ifdef SCAD_ALLOC_STATS_ENABLED
+  return GetAllocationStats().total.count;
+#else
+  return allocation_count;
+#endif
+}
+
+int64_t AllocatedBytes() {
+#ifdef SCAD_ALLOC_STATS_ENABLED
+  return GetAllocationStats().total.bytes;
+#else
+  return allocated_bytes;
+#endif
+}
+
+struct Workload {
+  std::string name;
+  std::function<Shape(Board* board)> build;
+};
+
+// The plate of gamepad_v1, without its case.
+Shape BuildGamepadPlate(Board* board) {
+  double x = 0;
+  for (int i = 0; i < 5; i++) {
+    for (int j = 0; j < 5; j++) {
+      board->AddKey().SetPosition(x, -19 * j, 0);
+    }
+    x += i == 0 ? 23 / 2.0 + 9 + 1 : 19;
+  }
+  PlateParams params;
+  params.outline = Polygon({{-16.5, 14}, {93, 14}, {93, -91}, {-16.5, -91}});
+  return MakePlate(board->key_pointers(), params);
+}
+
+// A 6x6 dactyl style board: tented, staggered columns curved around the fingers with switches,
+// caps, the connector web and a skirt. The layout is clean: no caps interfere and nothing reaches
+// into a cap's travel.
+Shape BuildDactyl(Board* board) {
+  const double kStagger[6] = {0, 0, 3, 6, 3, 0};
+  // The web and skirt posts sit this far outside the switch. Between the rows of a curved column
+  // the web rises above the switch, and posts on the switch edge would graze the cap's travel.
+  const double kPostOffset = 1;
+  KeyGrid grid(6, 6);
+  for (int c = 0; c < 6; ++c) {
+    TransformList column;
+    column.AddTransform(Transform(c * 22, kStagger[c], 0));
+    column.AddTransform(Transform::Rotation(0, 15, 0));
+    // High enough that the tented outer column stays above the floor of the skirt.
+    column.AddTransform(Transform(0, 0, 60));
+    std::shared_ptr<TransformNode> node = TransformNode::Create(column);
+    for (int r = 0; r < 6; ++r) {
+      Key& key = board->AddKey();
+      key.name = "r" + std::to_string(r) + "c" + std::to_string(c);
+      key.local_transforms = TransformList();
+      key.local_transforms.AddTransform(Transform(0, 0, -90));
+      Transform& curve =
+          key.local_transforms.AddTransform(Transform::Rotation((2.5 - r) * 15, 0, 0));
+      curve.z = 90;
+      key.type = r == 0 ? KeyType::SA_EDGE : KeyType::SA;
+      key.sa_edge_type = SaEdgeType::TOP;
+      key.SetParent(node);
+      grid.set_key(r, c, &key);
+    }
+  }
+  board->meshes.push_back(grid.GetWeb(kPostOffset));
+  SkirtParams skirt;
+  skirt.offset = kPostOffset;
+  skirt.draft_angle = 5;
+  board->meshes.push_back(grid.GetSkirt(skirt));
+
+  std::vector<Shape> shapes;
+  for (const Key* key : grid.keys()) {
+    shapes.push_back(key->GetSwitch());
+    shapes.push_back(key->GetCap());
+  }
+  for (const Mesh& mesh : board->meshes) {
+    shapes.push_back(mesh.ToShape());
+  }
+  return UnionAll(shapes);
+}
+
+// 100 flat keys in a 10x10 grid with switches, caps and the connector web.
+Shape BuildFlat100(Board* board) {
+  KeyGrid grid(10, 10);
+  for (int r = 0; r < 10; ++r) {
+    for (int c = 0; c < 10; ++c) {
+      Key& key = board->AddKey();
+      key.SetPosition(c * 19.05, r * -19.05, 0);
+      grid.set_key(r, c, &key);
+    }
+  }
+  board->meshes.push_back(grid.GetWeb());
+  std::vector<Shape> shapes;
+  for (const Key* key : grid.keys()) {
+    shapes.push_back(key->GetSwitch());
+    shapes.push_back(key->GetCap());
+  }
+  shapes.push_back(board->meshes.back().ToShape());
+  return UnionAll(shapes);
+}
+
+// A closed latitude / longitude sphere with 256 x 256 quads.
+Shape BuildPolyhedron(Board* board) {
+  const int kSegments = 256;
+  const double kPi = 3.14159265358979323846;
+  Mesh mesh;
+  int top = mesh.AddPoint(glm::vec3(0, 0, 50));
+  for (int i = 1; i < kSegments; ++i) {
+    double theta = kPi * i / kSegments;
+    for (int j = 0; j < kSegments; ++j) {
+      double phi = 2 * kPi * j / kSegments;
+      mesh.AddPoint(glm::vec3(50 * std::sin(theta) * std::cos(phi),
+                              50 * std::sin(theta) * std::sin(phi),
+                              50 * std::cos(theta)));
+    }
+  }
+  int bottom = mesh.AddPoint(glm::vec3(0, 0, -50));
+  auto ring = [&](int i, int j) { return 1 + (i - 1) * kSegments + (j % kSegments); };
+  for (int j = 0; j < kSegments; ++j) {
+    mesh.AddFace({top, ring(1, j + 1), ring(1, j)});
+    mesh.AddFace({bottom, ring(kSegments - 1, j), ring(kSegments - 1, j + 1)});
+    for (int i = 1; i + 1 < kSegments; ++i) {
+      mesh.AddFace({ring(i, j), ring(i, j + 1), ring(i + 1, j + 1), ring(i + 1, j)});
+    }
+  }
+  board->meshes.push_back(mesh);
+  return mesh.ToShape();
+}
+
+struct Timing {
+  double min = 0;
+  double median = 0;
+};
+
+Timing Summarize(std::vector<double> ms) {
+  std::sort(ms.begin(), ms.end());
+  Timing timing;
+  timing.min = ms.front();
+  timing.median = ms[ms.size() / 2];
+  return timing;
+}
+
+double Milliseconds(std::chrono::steady_clock::time_point start) {
+  std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+  return elapsed.count();
+}
+
+void PrintTiming(const char* name, const Timing& timing) {
+  printf("      \"%s\": {\"min\": %.3f, \"median\": %.3f},\n", name, timing.min, timing.median);
+}
+
+void RunWorkload(const Workload& workload, int iterations, bool hotspots, bool first) {
+  SCAD_TRACE_SCOPE_DETAIL("RunWorkload", workload.name);
+  // One untimed run so the cached switch and cap modules are built before measuring.
+  RenderCostEstimate render_cost;
+  {
+    Board board;
+    Shape shape = workload.build(&board);
+    shape.ToScad();
+    render_cost = EstimateRenderCost(shape);
+  }
+  if (hotspots) {
+    fprintf(stderr, "%s\n", workload.name.c_str());
+    WriteRenderCostReport(render_cost, stderr);
+    fprintf(stderr, "\n");
+  }
+
+  std::vector<double> construction;
+  std::vector<double> emission;
+  std::vector<double> evaluation;
+  int64_t allocations = 0;
+  int64_t bytes_allocated = 0;
+  AllocationStats allocation_stats;
+  size_t emitted_bytes = 0;
+  size_t num_keys = 0;
+  size_t num_interferences = 0;
+  size_t num_intrusions = 0;
+  for (int i = 0; i < iterations; ++i) {
+    Board board;
+    ResetAllocationStats();
+    int64_t count_before = AllocationCount();
+    int64_t bytes_before = AllocatedBytes();
+    auto start = std::chrono::steady_clock::now();
+    Shape shape = workload.build(&board);
+    construction.push_back(Milliseconds(start));
+    allocations = AllocationCount() - count_before;
+    bytes_allocated = AllocatedBytes() - bytes_before;
+    allocation_stats = GetAllocationStats();
+
+    start = std::chrono::steady_clock::now();
+    std::string scad = shape.ToScad();
+    emission.push_back(Milliseconds(start));
+    emitted_bytes = scad.size();
+
+    // The in process geometry checks.
+    start = std::chrono::steady_clock::now();
+    std::vector<const Key*> keys = board.key_pointers();
+    num_interferences = FindInterferences(keys).size();
+    num_intrusions = FindIntrusions(keys, board.meshes).size();
+    evaluation.push_back(Milliseconds(start));
+    num_keys = keys.size();
+  }
+
+  Timing emission_timing = Summarize(emission);
+  printf("%s    {\n", first ? "" : ",\n");
+  printf("      \"name\": \"%s\",\n", workload.name.c_str());
+  printf("      \"keys\": %zu,\n", num_keys);
+  PrintTiming("construction_ms", Summarize(construction));
+  printf("      \"construction_allocations\": %lld,\n", (long long)allocations);
+  printf("      \"construction_allocated_bytes\": %lld,\n", (long long)bytes_allocated);
+  if (allocation_stats.enabled) {
+    printf("      \"construction_allocations_by_category\": {\n");
+    for (int c = 0; c < kNumAllocationCategories; ++c) {
+      const AllocationCounters& counters = allocation_stats.categories[c];
+      printf("        \"%s\": {\"count\": %lld, \"bytes\": %lld, \"peak_live_bytes\": %lld}%s\n",
+             AllocationCategoryName(static_cast<AllocationCategory>(c)),
+             (long long)counters.count,
+             (long long)counters.bytes,
+             (long long)counters.peak_live_bytes,
+             c + 1 < kNumAllocationCategories ? "," : "");
+    }
+    printf("      },\n");
+    printf("      \"construction_peak_live_bytes\": %lld,\n",
+           (long long)allocation_stats.total.peak_live_bytes);
+  }
+  printf("      \"emitted_bytes\": %zu,\n", emitted_bytes);
+  PrintTiming("emission_ms", emission_timing);
+  printf("      \"emission_mb_per_s\": %.1f,\n",
+         emission_timing.median > 0 ? emitted_bytes / emission_timing.median / 1000 : 0.0);
+  PrintTiming("evaluation_ms", Summarize(evaluation));
+  printf("      \"interferences\": %zu,\n", num_interferences);
+  printf("      \"intrusions\": %zu,\n", num_intrusions);
+  printf("      \"estimated_render_cost\": %.0f\n", render_cost.total_cost);
+  printf("    }");
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  int iterations = 5;
+  std::string filter;
+  bool hotspots = false;
+  std::string trace_file;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      iterations = std::max(1, atoi(argv[++i]));
+    } else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+      filter = argv[++i];
+    } else if (strcmp(argv[i], "--hotspots") == 0) {
+      hotspots = true;
+    } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      trace_file = argv[++i];
+    } else {
+      fprintf(stderr,
+              "usage: %s [--iterations N] [--filter substring] [--hotspots] [--trace trace.json]\n",
+              argv[0]);
+      return 1;
+    }
+  }
+
+  const std::vector<Workload> workloads = {
+      {"gamepad_plate", BuildGamepadPlate},
+      {"dactyl_6x6", BuildDactyl},
+      {"flat_100", BuildFlat100},
+      {"polyhedron_sphere", BuildPolyhedron},
+  };
+
+  if (!trace_file.empty()) {
+    StartTracing();
+  }
+  printf("{\n  \"iterations\": %d,\n  \"workloads\": [\n", iterations);
+  bool first = true;
+  for (const Workload& workload : workloads) {
+    if (!filter.empty() && workload.name.find(filter) == std::string::npos) {
+      continue;
+    }
+    RunWorkload(workload, iterations, hotspots, first);
+    first = false;
+  }
+  printf("\n  ]\n}\n");
+  if (!trace_file.empty() && !WriteTrace(trace_file)) {
+    return 1;
+  }
+  return 0;
+}
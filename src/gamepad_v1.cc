@@ -1,11 +1,18 @@
 // Simple 5x5 grid keypad with 1.25 size keys in shift column.
+//
+// gamepad_v1 [--trace trace.json]
 
+#include <cstdio>
+#include <cstring>
 #include <glm/glm.hpp>
 #include <string>
 #include <vector>
 
 #include "key.h"
+#include "output_batch.h"
+#include "plate.h"
 #include "scad.h"
+#include "trace.h"
 #include "transform.h"
 
 using namespace scad;
@@ -30,22 +37,24 @@ void AddShapes(std::vector<Shape>* shapes, std::vector<Shape> to_add) {
   }
 }
 
-int main() {
-  printf("generating..\n");
-
+bool Generate() {
+  SCAD_TRACE_SCOPE("Generate");
   std::vector<Key> keys;
-  double x = 0;
-  for (int i = 0; i < 5; i++) {
-    for (int j = 0; j < 5; j++) {
-      double y = kSpacing * j * -1;
-      Key k;
-      k.SetPosition(x, y, 0);
-      keys.push_back(k);
-    }
-    if (i == 0) {
-      x += kMedStep + kSmallStep + 1;
-    } else {
-      x += kSpacing;
+  {
+    SCAD_TRACE_SCOPE("Layout");
+    double x = 0;
+    for (int i = 0; i < 5; i++) {
+      for (int j = 0; j < 5; j++) {
+        double y = kSpacing * j * -1;
+        Key k;
+        k.SetPosition(x, y, 0);
+        keys.push_back(k);
+      }
+      if (i == 0) {
+        x += kMedStep + kSmallStep + 1;
+      } else {
+        x += kSpacing;
+      }
     }
   }
 
@@ -61,7 +70,7 @@ int main() {
       }
     }
     UnionAll(test_shapes).WriteToFile("test_keys.scad");
-    return 0;
+    return true;
   }
 
   glm::vec3 top_left(-14 - 2.5, 14, 0);
@@ -76,19 +85,32 @@ int main() {
       {bottom_left.x, bottom_left.y},
   });
 
-  glm::vec3 zero(0.0, 0.0, 0.0);
-  Key k;
-  double z = k.GetTopLeft().Apply(zero).z;
-
-  plate = plate.LinearExtrude(4).TranslateZ(z - 2);
-
-  std::vector<Shape> key_holes;
+  std::vector<Key> plate_key_copies;
   for (Key key : keys) {
     key.add_side_nub = true;
     key.add_top_nub = false;
-    key_holes.push_back(key.GetInverseSwitch());
+    plate_key_copies.push_back(key);
+  }
+  std::vector<const Key*> plate_keys;
+  for (const Key& key : plate_key_copies) {
+    plate_keys.push_back(&key);
+  }
+  PlateParams plate_params;
+  plate_params.outline = plate;
+  // Written together at the end, each file on its own thread.
+  OutputBatch outputs;
+  std::vector<const Key*> off_plane_keys;
+  outputs.Add(MakePlate(plate_keys, plate_params, &off_plane_keys), "test_keys.scad");
+  for (const Key* key : off_plane_keys) {
+    // The gamepad keys are not named, so they are reported by index and position.
+    glm::vec3 p = key->GetMiddlePoint();
+    fprintf(stderr,
+            "Key %d at (%.2f, %.2f, %.2f) is not in the plate plane\n",
+            static_cast<int>(key - plate_key_copies.data()),
+            p.x,
+            p.y,
+            p.z);
   }
-  plate.Subtract(UnionAll(key_holes)).WriteToFile("test_keys.scad");
 
   double holder_y = 28;
   double holder_x = 60;
@@ -161,10 +183,10 @@ int main() {
                        .TranslateZ(7.5 / 2.0)
                        .Translate(top_left.x, (top_left.y + under_top_left.y) / 2.0, 1.2);
 
-  Union(wall, bottom_poly).Subtract(usb_hole).WriteToFile("bottom.scad");
+  outputs.Add(Union(wall, bottom_poly).Subtract(usb_hole), "bottom.scad");
 
   Shape post = Cube(3, 3, wall_height);
-  post.WriteToFile("post.scad");
+  outputs.Add(post, "post.scad");
 
   double hole_x = under_top_mid.x - 12;
   double hole_y = under_top_mid.y - 12.5;
@@ -176,7 +198,27 @@ int main() {
                       })
                   .Subtract(Circle(1.5, 30).Translate(hole_x, hole_y, 0))
                   .LinearExtrude(4);
-  top.WriteToFile("top.scad");
+  outputs.Add(top, "top.scad");
+  return outputs.Write();
+}
+
+int main(int argc, char** argv) {
+  std::string trace_file;
+  if (argc == 3 && strcmp(argv[1], "--trace") == 0) {
+    trace_file = argv[2];
+    StartTracing();
+  } else if (argc != 1) {
+    fprintf(stderr, "usage: %s [--trace trace.json]\n", argv[0]);
+    return 1;
+  }
 
+  printf("generating..\n");
+  if (!Generate()) {
+    return 1;
+  }
+
+  if (!trace_file.empty() && !WriteTrace(trace_file)) {
+    return 1;
+  }
   return 0;
 }
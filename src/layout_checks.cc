@@ -0,0 +1,288 @@
+// Known answer checks for the in process layout tools: cap interference, cap travel clearance, the
+// KLE importer, the reach cost, the layout optimizer, the sweep engine and the post slabs. Each
+// check builds a tiny layout whose answer is obvious.
+//
+// layout_checks
+//
+// Prints every failed check and exits non zero if there were any.
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <glm/glm.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "clearance.h"
+#include "interference.h"
+#include "key.h"
+#include "kle.h"
+#include "mesh.h"
+#include "optimizer.h"
+#include "scad.h"
+#include "sweep.h"
+#include "transform.h"
+
+using namespace scad;
+
+namespace {
+
+int num_checks = 0;
+int num_failures = 0;
+
+void Check(bool condition, const std::string& name) {
+  ++num_checks;
+  if (!condition) {
+    ++num_failures;
+    fprintf(stderr, "FAILED %s\n", name.c_str());
+  }
+}
+
+bool Near(double a, double b, double tolerance = 1e-3) {
+  return std::abs(a - b) <= tolerance;
+}
+
+// Half the width of a DSA cap at its widest, the caps of keys this far apart on x touch.
+double CapHalfWidth() {
+  double half_width = 0;
+  for (const glm::vec3& p : Key(0, 0, 0).GetCapPoints()) {
+    half_width = std::max<double>(half_width, p.x);
+  }
+  return half_width;
+}
+
+size_t CountCapInterferences(double spacing) {
+  Key left(0, 0, 0);
+  Key right(spacing, 0, 0);
+  InterferenceParams params;
+  params.check_travel = false;
+  return FindInterferences({&left, &right}, params).size();
+}
+
+void CheckInterference() {
+  double touching = 2 * CapHalfWidth();
+  Check(CountCapInterferences(touching + 1) == 0, "separated caps do not interfere");
+  Check(CountCapInterferences(touching) == 0, "touching caps do not interfere");
+  Check(CountCapInterferences(touching - 1) == 1, "overlapping caps interfere");
+
+  Key left(0, 0, 0);
+  Key right(touching, 0, 0);
+  InterferenceParams params;
+  params.check_travel = false;
+  params.tolerance = 0;
+  Check(FindInterferences({&left, &right}, params).size() == 1,
+        "touching caps interfere without a tolerance");
+}
+
+void CheckClearance() {
+  Key key(0, 0, 0);
+  // A block in the path of the cap, and one well to the side of it.
+  Mesh in_path = MakeBoxMesh(glm::vec3(-2, -2, 6), glm::vec3(2, 2, 9));
+  Mesh beside = MakeBoxMesh(glm::vec3(15, -2, 0), glm::vec3(20, 2, 9));
+  std::vector<Intrusion> intrusions = FindIntrusions({&key}, {in_path, beside});
+  Check(intrusions.size() == 1, "a box in the cap path intrudes");
+  if (!intrusions.empty()) {
+    Check(intrusions[0].key == &key && intrusions[0].mesh_index == 0,
+          "the intrusion names the key and the box");
+    Check(intrusions[0].depth > 1, "the intrusion is deep");
+  }
+  Check(FindIntrusions({&key}, {beside}).empty(), "a box beside the key does not intrude");
+
+  Mesh around = MakeBoxMesh(glm::vec3(-50, -50, -20), glm::vec3(50, 50, 80));
+  intrusions = FindIntrusions({&key}, {around});
+  Check(intrusions.size() == 1 && intrusions[0].mesh_index == 0,
+        "a solid around the whole cap path intrudes");
+}
+
+void CheckKle() {
+  KleLayout layout;
+  std::string error;
+  bool parsed = ParseKle(R"([["Q","W","E"]])", &layout, {}, &error);
+  Check(parsed, "a KLE row parses: " + error);
+  if (!parsed) {
+    return;
+  }
+  KeyGrid grid = layout.MakeGrid();
+  Check(grid.num_rows() == 1 && grid.num_columns() == 3, "a KLE row makes a 1x3 grid");
+  if (grid.num_columns() != 3) {
+    return;
+  }
+  Check(grid.get_key(0, 0)->name == "Q" && grid.get_key(0, 2)->name == "E",
+        "KLE keys keep their legends in order");
+  double spacing = grid.get_key(0, 1)->GetMiddlePoint().x - grid.get_key(0, 0)->GetMiddlePoint().x;
+  Check(Near(spacing, 19.05), "KLE keys are one unit apart");
+
+  // The second row starts a unit in, so its only key sits in the second column.
+  KleLayout staggered;
+  parsed = ParseKle(R"([["A","B"],[{x:1},"C"]])", &staggered);
+  Check(parsed, "a KLE layout with an offset row parses");
+  if (parsed) {
+    KeyGrid staggered_grid = staggered.MakeGrid();
+    Check(staggered_grid.num_columns() == 2 && staggered_grid.get_key(1, 0) == nullptr &&
+              staggered_grid.get_key(1, 1) && staggered_grid.get_key(1, 1)->name == "C",
+          "KLE grid columns follow key positions");
+  }
+
+  // The second key is moved back on top of the first, so the row has one column for two keys.
+  KleLayout stacked;
+  parsed = ParseKle(R"([["A",{x:-1},"B"]])", &stacked);
+  Check(parsed, "a KLE layout with stacked keys parses");
+  if (parsed) {
+    std::vector<const Key*> dropped;
+    KeyGrid stacked_grid = stacked.MakeGrid(&dropped);
+    Check(stacked_grid.num_columns() == 1 && dropped.size() == 1 && dropped[0]->name == "B",
+          "KLE keys left out of the grid are reported");
+  }
+}
+
+void CheckReach() {
+  Key key(0, 0, 0);
+  double cap_top = 0;
+  for (const glm::vec3& p : key.GetCapPoints()) {
+    cap_top = std::max<double>(cap_top, p.z);
+  }
+  // A knuckle straight above the cap, exactly reach from its top, costs nothing.
+  OptimizerParams params;
+  ReachTarget target;
+  target.key = &key;
+  target.knuckle = glm::vec3(0, 0, cap_top + target.reach);
+  params.targets = {target};
+  Check(Near(OptimizeLayout(params).initial_cost, 0), "reach is measured from the cap top");
+}
+
+// Two single key columns. The left key's knuckle is further left than its column may move, and
+// the right key's knuckle is over the left key, so the right column wants to slide onto it and has
+// to stop where the caps touch.
+void CheckOptimizer() {
+  double touching = 2 * CapHalfWidth();
+  TransformList right_offset;
+  right_offset.AddTransform(Transform(touching + 12, 0, 0));
+  std::shared_ptr<TransformNode> left_node = TransformNode::Create();
+  std::shared_ptr<TransformNode> right_node = TransformNode::Create(right_offset);
+  Key left(0, 0, 0);
+  Key right(0, 0, 0);
+  left.SetParent(left_node);
+  right.SetParent(right_node);
+  double cap_top = 0;
+  for (const glm::vec3& p : left.GetCapPoints()) {
+    cap_top = std::max<double>(cap_top, p.z);
+  }
+
+  OptimizerParams params;
+  params.keys = {&left, &right};
+  ReachTarget left_target;
+  left_target.key = &left;
+  left_target.knuckle = glm::vec3(-10, 0, cap_top + left_target.reach);
+  ReachTarget right_target = left_target;
+  right_target.key = &right;
+  right_target.knuckle.x = 0;
+  params.targets = {left_target, right_target};
+  OptimizerColumn left_column;
+  left_column.node = left_node;
+  left_column.step.x = 1;
+  left_column.limit.x = 2;
+  OptimizerColumn right_column;
+  right_column.node = right_node;
+  right_column.step.x = 4;
+  params.columns = {left_column, right_column};
+  params.num_threads = 2;
+
+  OptimizerResult result = OptimizeLayout(params);
+  Check(result.cost < result.initial_cost, "the optimizer lowers the cost");
+  Check(result.adjustments.size() == 2 && Near(result.adjustments[0].x, -2) &&
+            result.adjustments[1].x < 0,
+        "the optimizer moves the columns within their limits");
+  InterferenceParams caps;
+  caps.check_travel = false;
+  Check(FindInterferences({&left, &right}, caps).empty(),
+        "the optimizer does not move caps into each other");
+
+  // Costing the moved keys from scratch matches the cost the incremental search ended with.
+  OptimizerParams recheck = params;
+  recheck.max_iterations = 0;
+  Check(Near(OptimizeLayout(recheck).initial_cost, result.cost),
+        "the optimized cost matches the moved keys");
+
+  OptimizerParams missing_node = params;
+  missing_node.columns[0].node = nullptr;
+  Check(OptimizeLayout(missing_node).adjustments.empty(), "a column without a node is rejected");
+}
+
+void CheckSweep() {
+  SweepParams params;
+  params.axes = {{"spacing", {15, 25}}};
+  params.num_threads = 2;
+  std::vector<SweepMetrics> metrics = RunSweep(params, [](const SweepVariant& variant) {
+    SweepOutput output;
+    output.keys = {Key(0, 0, 0), Key(variant.Get("spacing"), 0, 0)};
+    output.shape = Hull(Cube(1), Cube(1).TranslateX(variant.Get("spacing")));
+    return output;
+  });
+  Check(metrics.size() == 2, "a two value axis makes two variants");
+  if (metrics.size() != 2) {
+    return;
+  }
+  Check(metrics[0].variant.values[0] == 15 && metrics[1].variant.values[0] == 25,
+        "sweep results are in variant order");
+  Check(metrics[0].hull_count == 1 && metrics[1].hull_count == 1, "sweep counts the hull");
+  Check(metrics[0].interference_count > 0, "close keys interfere in the sweep");
+  Check(metrics[1].interference_count == 0, "spaced keys do not interfere in the sweep");
+  Check(metrics[0].output_hash != metrics[1].output_hash, "different outputs hash differently");
+
+  std::vector<SweepMetrics> outlived;
+  {
+    SweepParams temporary;
+    temporary.axes = {{"size", {2}}};
+    outlived = RunSweep(temporary, [](const SweepVariant& variant) {
+      SweepOutput output;
+      output.shape = Cube(variant.Get("size"));
+      return output;
+    });
+  }
+  Check(outlived.size() == 1 && outlived[0].variant.Get("size") == 2,
+        "sweep results outlive their params");
+
+  SweepParams empty_axis;
+  empty_axis.axes = {{"spacing", {}}};
+  empty_axis.random_samples = 4;
+  Check(RunSweep(empty_axis, [](const SweepVariant&) { return SweepOutput(); }).empty(),
+        "a sweep with an empty axis is rejected");
+}
+
+void CheckPostSlab() {
+  TransformList left;
+  left.AddTransform({0, 0, 0});
+  TransformList right;
+  right.AddTransform({10, 0, 0});
+  TransformList top;
+  top.AddTransform({5, 0, 5});
+  TransformList back;
+  back.AddTransform({5, 10, 5});
+  ShapeStats wall = TriMeshSlab({left, right, top}).Stats(0, false);
+  Check(wall.kind_counts[static_cast<int>(ShapeKind::HULL)] == 0 &&
+            wall.kind_counts[static_cast<int>(ShapeKind::PRIMITIVE)] == 1,
+        "a wall triangle slab is one polyhedron");
+  ShapeStats mixed = TriMeshSlab({left, right, top, back}).Stats(0, false);
+  Check(mixed.kind_counts[static_cast<int>(ShapeKind::HULL)] == 0 &&
+            mixed.kind_counts[static_cast<int>(ShapeKind::PRIMITIVE)] == 2,
+        "a wall and a sloped triangle make two polyhedrons");
+}
+
+}  // namespace
+
+int main() {
+  CheckInterference();
+  CheckClearance();
+  CheckKle();
+  CheckReach();
+  CheckOptimizer();
+  CheckSweep();
+  CheckPostSlab();
+  if (num_failures > 0) {
+    fprintf(stderr, "%d of %d checks failed\n", num_failures, num_checks);
+    return 1;
+  }
+  printf("%d checks passed\n", num_checks);
+  return 0;
+}
@@ -0,0 +1,847 @@
+// Differential fuzzing of shape emission. Random shape trees are built from the constructors in
+// scad.h next to a plain reference tree, and the text of every emission path (AppendScad, ToScad
+// with modules expanded back inline, WriteToFile, Prerender and the Stats byte counting) must match
+// the text written from the reference. Meshes are checked geometrically instead: the written
+// polyhedron is read back and its points and volume are compared with the mesh's.
+//
+// scad_fuzz [--seed N] [--iterations N] [--max-depth N]
+//
+// Exits non zero on the first mismatch, printing the seed and iteration which reproduce it.
+
+#include <cmath>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <functional>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <map>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "key.h"
+#include "mesh.h"
+#include "render_cost.h"
+#include "scad.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#else
+#include <process.h>
+#define getpid _getpid
+#endif
+
+using namespace scad;
+
+namespace {
+
+// What the shape under test should write, built without any of the Shape machinery.
+struct Ref {
+  enum Kind { EMPTY, PRIMITIVE, COMPOSITE, COMMENT, PASS };
+  Kind kind = EMPTY;
+  // The primitive's line, the composite's name or the comment text.
+  std::string text;
+  std::vector<std::shared_ptr<const Ref>> children;
+};
+using RefPtr = std::shared_ptr<const Ref>;
+
+void WriteRef(const Ref& ref, int indent_level, std::string* out) {
+  std::string indent(indent_level * kTabSize, ' ');
+  switch (ref.kind) {
+    case Ref::EMPTY:
+      return;
+    case Ref::PRIMITIVE:
+      *out += indent + ref.text + "\n";
+      return;
+    case Ref::COMPOSITE:
+      *out += indent + ref.text + " {\n";
+      for (const RefPtr& child : ref.children) {
+        WriteRef(*child, indent_level + 1, out);
+      }
+      *out += indent + "}\n";
+      return;
+    case Ref::COMMENT:
+      *out += indent + "/* " + ref.text + " */\n";
+      WriteRef(*ref.children[0], indent_level, out);
+      return;
+    case Ref::PASS:
+      WriteRef(*ref.children[0], indent_level, out);
+      return;
+  }
+}
+
+std::string RefText(const RefPtr& ref, int indent_level = 0) {
+  std::string out;
+  WriteRef(*ref, indent_level, &out);
+  return out;
+}
+
+std::string Format(const char* format, ...) {
+  va_list args;
+  va_start(args, format);
+  char buffer[512];
+  vsnprintf(buffer, sizeof(buffer), format, args);
+  va_end(args);
+  return buffer;
+}
+
+RefPtr MakeRef(Ref::Kind kind, std::string text, std::vector<RefPtr> children = {}) {
+  auto ref = std::make_shared<Ref>();
+  ref->kind = kind;
+  ref->text = std::move(text);
+  ref->children = std::move(children);
+  return ref;
+}
+
+std::string ReadFile(std::FILE* file) {
+  std::string text;
+  std::rewind(file);
+  char buffer[4096];
+  size_t n;
+  while ((n = std::fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    text.append(buffer, n);
+  }
+  return text;
+}
+
+std::string Render(const std::function<void(std::FILE*)>& writer) {
+  std::FILE* file = std::tmpfile();
+  if (file == nullptr) {
+    fprintf(stderr, "Unable to open a temporary file\n");
+    exit(2);
+  }
+  writer(file);
+  std::string text = ReadFile(file);
+  std::fclose(file);
+  return text;
+}
+
+// Replaces every module call in ToScad output with the module's body, giving what AppendScad writes
+// without modules.
+std::string InlineModules(const std::string& text) {
+  size_t definitions = text.find("\nmodule ");
+  std::string main = text.substr(0, definitions == std::string::npos ? text.size() : definitions);
+  std::map<std::string, std::vector<std::string>> bodies;
+  size_t at = definitions == std::string::npos ? text.size() : definitions + 1;
+  while (at < text.size()) {
+    // "\nmodule name() {\n" ... "}\n"
+    at = text.find("module ", at);
+    size_t name_end = text.find("() {\n", at);
+    std::string name = text.substr(at + 7, name_end - at - 7);
+    at = name_end + 5;
+    std::vector<std::string>& lines = bodies[name];
+    while (at < text.size() && text.compare(at, 2, "}\n") != 0) {
+      size_t end = text.find('\n', at) + 1;
+      // Bodies are written one level in.
+      lines.push_back(text.substr(at + kTabSize, end - at - kTabSize));
+      at = end;
+    }
+    at += 2;
+    while (at < text.size() && text[at] == '\n') {
+      ++at;
+    }
+  }
+
+  std::function<void(const std::string&, const std::string&, std::string*)> expand =
+      [&](const std::string& line, const std::string& prefix, std::string* out) {
+        size_t indent = line.find_first_not_of(' ');
+        if (indent != std::string::npos && line.size() > indent + 4 &&
+            line.compare(line.size() - 4, 4, "();\n") == 0) {
+          auto it = bodies.find(line.substr(indent, line.size() - indent - 4));
+          if (it != bodies.end()) {
+            for (const std::string& body_line : it->second) {
+              expand(body_line, prefix + line.substr(0, indent), out);
+            }
+            return;
+          }
+        }
+        *out += prefix + line;
+      };
+  std::string result;
+  size_t start = 0;
+  while (start < main.size()) {
+    size_t end = main.find('\n', start);
+    end = end == std::string::npos ? main.size() : end + 1;
+    expand(main.substr(start, end - start), "", &result);
+    start = end;
+  }
+  return result;
+}
+
+// Reads back a polyhedron written by Polyhedron, or returns false.
+bool ParsePolyhedron(const std::string& text, Mesh* mesh) {
+  const char* p = strstr(text.c_str(), "polyhedron (points = [");
+  if (p == nullptr) {
+    return false;
+  }
+  p += strlen("polyhedron (points = [");
+  while (*p == '[') {
+    double x, y, z;
+    int consumed = 0;
+    if (sscanf(p, "[%lf, %lf, %lf]%n", &x, &y, &z, &consumed) != 3) {
+      return false;
+    }
+    mesh->AddPoint(glm::vec3(x, y, z));
+    p += consumed;
+    p += *p == ',' ? 1 : 0;
+  }
+  if (strncmp(p, "], faces = [", 12) != 0) {
+    return false;
+  }
+  p += 12;
+  while (*p == '[') {
+    ++p;
+    std::vector<int> face;
+    while (*p != ']') {
+      char* end = nullptr;
+      face.push_back(static_cast<int>(strtol(p, &end, 10)));
+      if (end == p) {
+        return false;
+      }
+      p = end + (*end == ',' ? 1 : 0);
+    }
+    mesh->AddFace(std::move(face));
+    ++p;
+    p += *p == ',' ? 1 : 0;
+  }
+  return strncmp(p, "], convexity = ", 15) == 0;
+}
+
+struct Sample {
+  Shape shape;
+  RefPtr ref;
+};
+
+class Generator {
+ public:
+  Generator(uint32_t seed, int max_depth) : random_(seed), max_depth_(max_depth) {
+  }
+
+  Sample Make(int depth = 0) {
+    // Reusing earlier samples makes subtrees shared between places, as modules and prerendered
+    // shapes are in real boards.
+    if (!pool_.empty() && Chance(0.15)) {
+      return pool_[Int(0, static_cast<int>(pool_.size()) - 1)];
+    }
+    Sample sample = depth >= max_depth_ || Chance(0.3) ? MakePrimitive() : MakeComposite(depth);
+    pool_.push_back(sample);
+    return sample;
+  }
+
+  Mesh MakeMesh() {
+    switch (Int(0, 2)) {
+      case 0: {
+        glm::mat4 m = glm::translate(glm::mat4(1), glm::vec3(Real(-50, 50), Real(-50, 50), 0));
+        m = glm::rotate(m, static_cast<float>(Real(0, 6)), glm::normalize(glm::vec3(
+                                                              Real(0.1, 1), Real(-1, 1), 1)));
+        glm::vec3 min(Real(-10, 0), Real(-10, 0), Real(-10, 0));
+        return MakeBoxMesh(min, min + glm::vec3(Real(1, 20), Real(1, 20), Real(1, 20)), m);
+      }
+      case 1: {
+        const KeyType kTypes[] = {
+            KeyType::DSA, KeyType::SA, KeyType::SA_EDGE, KeyType::SA_TALL_EDGE};
+        CapLoftParams params = GetCapLoftParams(kTypes[Int(0, 3)],
+                                                Chance(0.5) ? SaEdgeType::TOP : SaEdgeType::BOTTOM);
+        params.dish_resolution = Int(1, 10);
+        return MakeCapMesh(params);
+      }
+      default: {
+        // A slab under a random height field.
+        int n = Int(2, 6);
+        SlabBuilder builder;
+        for (int i = 0; i <= n; ++i) {
+          for (int j = 0; j <= n; ++j) {
+            glm::vec3 top(i * 10, j * 10, Real(0, 8));
+            builder.AddVertex(top, top - glm::vec3(0, 0, Real(1, 4)));
+          }
+        }
+        for (int i = 0; i < n; ++i) {
+          for (int j = 0; j < n; ++j) {
+            int a = i * (n + 1) + j;
+            builder.AddTriangle(a, a + 1, a + n + 2);
+            builder.AddTriangle(a, a + n + 2, a + n + 1);
+          }
+        }
+        return builder.Build();
+      }
+    }
+  }
+
+ private:
+  bool Chance(double p) {
+    return std::uniform_real_distribution<double>(0, 1)(random_) < p;
+  }
+
+  int Int(int min, int max) {
+    return std::uniform_int_distribution<int>(min, max)(random_);
+  }
+
+  // Values on a 1/8 grid so %.3f and %f write them exactly.
+  double Real(double min, double max) {
+    return std::round(std::uniform_real_distribution<double>(min, max)(random_) * 8) / 8;
+  }
+
+  bool Bool() {
+    return Chance(0.5);
+  }
+
+  std::string Fixed(double value) {
+    return Format("%.3f", value);
+  }
+
+  const char* BoolText(bool b) {
+    return b ? "true" : "false";
+  }
+
+  Sample MakePrimitive() {
+    switch (Int(0, 13)) {
+      case 0: {
+        CubeParams params;
+        params.x = Real(0.5, 20);
+        params.y = Real(0.5, 20);
+        params.z = Real(0.5, 20);
+        params.center = Bool();
+        return {Cube(params), CubeRef(params.x, params.y, params.z, params.center)};
+      }
+      case 1: {
+        double x = Real(0.5, 20), y = Real(0.5, 20), z = Real(0.5, 20);
+        bool center = Bool();
+        return {Cube(x, y, z, center), CubeRef(x, y, z, center)};
+      }
+      case 2: {
+        double size = Real(0.5, 20);
+        return {Cube(size), CubeRef(size, size, size, true)};
+      }
+      case 3: {
+        SphereParams params;
+        params.r = Real(0.5, 10);
+        std::string text = "sphere (r = " + Fixed(params.r);
+        if (Bool()) {
+          params.fs = Real(0.5, 2);
+          text += ", $fs = " + Fixed(params.fs.value());
+        }
+        if (Bool()) {
+          params.fn = Int(3, 64);
+          text += ", $fn = " + Fixed(params.fn.value());
+        }
+        if (Bool()) {
+          params.fa = Real(1, 12);
+          text += ", $fa = " + Fixed(params.fa.value());
+        }
+        return {Sphere(params), MakeRef(Ref::PRIMITIVE, text + ");")};
+      }
+      case 4: {
+        double r = Real(0.5, 10);
+        if (Bool()) {
+          return {Sphere(r), MakeRef(Ref::PRIMITIVE, "sphere (r = " + Fixed(r) + ");")};
+        }
+        double fn = Int(3, 64);
+        return {Sphere(r, fn),
+                MakeRef(Ref::PRIMITIVE, "sphere (r = " + Fixed(r) + ", $fn = " + Fixed(fn) + ");")};
+      }
+      case 5: {
+        CircleParams params;
+        params.r = Real(0.5, 10);
+        std::string text = "circle (r = " + Fixed(params.r);
+        if (Bool()) {
+          params.fn = Int(3, 64);
+          text += ", $fn = " + Fixed(params.fn.value());
+        }
+        Shape shape = Bool() ? Circle(params)
+                             : (params.fn.has_value() ? Circle(params.r, params.fn.value())
+                                                      : Circle(params.r));
+        return {shape, MakeRef(Ref::PRIMITIVE, text + ");")};
+      }
+      case 6: {
+        CylinderParams params;
+        params.h = Real(0.5, 20);
+        params.r1 = Real(0.5, 10);
+        params.r2 = Bool() ? params.r1 : Real(0.5, 10);
+        params.center = Bool();
+        std::string text = "cylinder(h = " + Fixed(params.h) + ", r1 = " + Fixed(params.r1) +
+                           ", r2 = " + Fixed(params.r2) + ", center = " + BoolText(params.center);
+        if (Bool()) {
+          params.fn = Int(3, 64);
+          text += ", $fn = " + Fixed(params.fn.value());
+        }
+        return {Cylinder(params), MakeRef(Ref::PRIMITIVE, text + ");")};
+      }
+      case 7: {
+        double h = Real(0.5, 20), r = Real(0.5, 10);
+        std::string text = "cylinder(h = " + Fixed(h) + ", r1 = " + Fixed(r) + ", r2 = " +
+                           Fixed(r) + ", center = true";
+        if (Bool()) {
+          return {Cylinder(h, r), MakeRef(Ref::PRIMITIVE, text + ");")};
+        }
+        double fn = Int(3, 64);
+        return {Cylinder(h, r, fn), MakeRef(Ref::PRIMITIVE, text + ", $fn = " + Fixed(fn) + ");")};
+      }
+      case 8: {
+        double x = Real(0.5, 20), y = Real(0.5, 20);
+        bool center = Bool();
+        Shape shape;
+        if (Bool()) {
+          shape = Square(x, y, center);
+        } else {
+          shape = Square(x, center);
+          y = x;
+        }
+        return {shape,
+                MakeRef(Ref::PRIMITIVE,
+                        "square (size = [" + Fixed(x) + ", " + Fixed(y) +
+                            "], center = " + BoolText(center) + ");")};
+      }
+      case 9: {
+        std::vector<Point2d> points;
+        std::string text = "polygon (points = [";
+        for (int i = 0, n = Int(0, 8); i < n; ++i) {
+          points.push_back({Real(-20, 20), Real(-20, 20)});
+          text += std::string(i ? "," : "") + "[" + Fixed(points.back().x) + ", " +
+                  Fixed(points.back().y) + "]";
+        }
+        return {Polygon(points), MakeRef(Ref::PRIMITIVE, text + "]);")};
+      }
+      case 10: {
+        int n = Int(3, 12);
+        double r = Real(1, 20);
+        std::string text = "polygon (points = [";
+        for (int i = 0; i < n; ++i) {
+          double step = (2.0 * 3.14159265358979323846) / n;
+          text += std::string(i ? "," : "") + "[" + Fixed(r * sin(step * i)) + ", " +
+                  Fixed(r * cos(step * i)) + "]";
+        }
+        return {RegularPolygon(n, r), MakeRef(Ref::PRIMITIVE, text + "]);")};
+      }
+      case 11: {
+        std::vector<Point3d> points;
+        std::vector<std::vector<int>> faces;
+        std::string text = "polyhedron (points = [";
+        int num_points = Int(0, 8);
+        for (int i = 0; i < num_points; ++i) {
+          points.push_back({Real(-20, 20), Real(-20, 20), Real(-20, 20)});
+          text += std::string(i ? "," : "") + "[" + Fixed(points.back().x) + ", " +
+                  Fixed(points.back().y) + ", " + Fixed(points.back().z) + "]";
+        }
+        text += "], faces = [";
+        for (int f = 0, n = num_points > 0 ? Int(0, 6) : 0; f < n; ++f) {
+          faces.emplace_back();
+          text += std::string(f ? "," : "") + "[";
+          for (int i = 0, m = Int(0, 5); i < m; ++i) {
+            faces.back().push_back(Int(0, num_points - 1));
+            text += std::string(i ? "," : "") + std::to_string(faces.back().back());
+          }
+          text += "]";
+        }
+        int convexity = Int(1, 10);
+        return {Polyhedron(points, faces, convexity),
+                MakeRef(Ref::PRIMITIVE, text + Format("], convexity = %d);", convexity))};
+      }
+      case 12: {
+        std::string file_name = Format("part_%d.stl", Int(0, 99));
+        int convexity = Int(-1, 4);
+        std::string text =
+            convexity > 0
+                ? Format("import (file = \"%s\", convexity = %d);", file_name.c_str(), convexity)
+                : Format("import (file = \"%s\");", file_name.c_str());
+        return {Import(file_name, convexity), MakeRef(Ref::PRIMITIVE, text)};
+      }
+      default: {
+        std::string text = Format("text (\"t%d\");", Int(0, 99));
+        if (Bool()) {
+          return {Shape::LiteralPrimitive(text), MakeRef(Ref::PRIMITIVE, text)};
+        }
+        if (Bool()) {
+          return {Shape::Primitive([text](std::FILE* file) { fprintf(file, "%s", text.c_str()); }),
+                  MakeRef(Ref::PRIMITIVE, text)};
+        }
+        return {Shape(), MakeRef(Ref::EMPTY, "")};
+      }
+    }
+  }
+
+  RefPtr CubeRef(double x, double y, double z, bool center) {
+    return MakeRef(Ref::PRIMITIVE,
+                   "cube (size = [ " + Fixed(x) + ", " + Fixed(y) + ", " + Fixed(z) +
+                       "], center = " + BoolText(center) + ");");
+  }
+
+  Sample Wrap(const Sample& child, const Shape& shape, const std::string& name) {
+    return {shape, MakeRef(Ref::COMPOSITE, name, {child.ref})};
+  }
+
+  Sample MakeComposite(int depth) {
+    int choice = Int(0, 21);
+    if (choice <= 6) {
+      std::vector<Sample> children;
+      for (int i = 0, n = Int(0, 4); i < n; ++i) {
+        children.push_back(Make(depth + 1));
+      }
+      std::vector<Shape> shapes;
+      std::vector<RefPtr> refs;
+      for (const Sample& child : children) {
+        shapes.push_back(child.shape);
+        refs.push_back(child.ref);
+      }
+      const char* const kNames[] = {
+          "hull ()", "union ()", "difference ()", "intersection ()", "minkowski ()", "group ()"};
+      Shape shape;
+      switch (choice) {
+        case 0:
+          shape = HullAll(shapes);
+          break;
+        case 1:
+          shape = UnionAll(shapes);
+          break;
+        case 2:
+          shape = DifferenceAll(shapes);
+          break;
+        case 3:
+          shape = IntersectionAll(shapes);
+          break;
+        case 4:
+          if (shapes.size() != 2) {
+            shapes.resize(2);
+            refs.resize(2, MakeRef(Ref::EMPTY, ""));
+          }
+          shape = Minkowski(shapes[0], shapes[1]);
+          break;
+        case 5:
+          shape = Shape::LiteralComposite("group ()", shapes);
+          break;
+        default:
+          shape = Shape::Composite([](std::FILE* file) { fprintf(file, "group ()"); }, shapes);
+          choice = 5;
+          break;
+      }
+      return {shape, MakeRef(Ref::COMPOSITE, kNames[choice], refs)};
+    }
+
+    Sample child = Make(depth + 1);
+    const Shape& s = child.shape;
+    double x = Real(-50, 50), y = Real(-50, 50), z = Real(-50, 50), w = Real(0, 1);
+    switch (choice) {
+      case 7: {
+        auto name = [](double x, double y, double z) {
+          return Format("translate ([%.3f, %.3f, %.3f])", x, y, z);
+        };
+        switch (Int(0, 4)) {
+          case 0:
+            return Wrap(child, s.Translate(x, y, z), name(x, y, z));
+          case 1:
+            return Wrap(child, s.Translate(glm::vec3(x, y, z)), name(x, y, z));
+          case 2:
+            return Wrap(child, s.TranslateX(x), name(x, 0, 0));
+          case 3:
+            return Wrap(child, s.TranslateY(y), name(0, y, 0));
+          default:
+            return Wrap(child, s.TranslateZ(z), name(0, 0, z));
+        }
+      }
+      case 8:
+        switch (Int(0, 2)) {
+          case 0:
+            return Wrap(child, s.Mirror(x, y, z), Format("mirror ([%.3f, %.3f, %.3f])", x, y, z));
+          case 1:
+            return Wrap(child, s.MirrorX(), "mirror ([1.000, 0.000, 0.000])");
+          default:
+            return Wrap(child, s.MirrorY(), "mirror ([0.000, 1.000, 0.000])");
+        }
+      case 9:
+        return Wrap(child, s.Rotate(x, y, z), Format("rotate ([%.3f, %.3f, %.3f])", x, y, z));
+      case 10: {
+        const char* kAxes[] = {"1.000, 0.000, 0.000", "0.000, 1.000, 0.000", "0.000, 0.000, 1.000"};
+        switch (Int(0, 3)) {
+          case 0:
+            return Wrap(child,
+                        s.Rotate(w * 360, x, y, z),
+                        Format("rotate (a = %.3f, v = [%.3f, %.3f, %.3f])", w * 360, x, y, z));
+          case 1:
+            return Wrap(child, s.RotateX(x), Format("rotate (a = %.3f, v = [%s])", x, kAxes[0]));
+          case 2:
+            return Wrap(child, s.RotateY(x), Format("rotate (a = %.3f, v = [%s])", x, kAxes[1]));
+          default:
+            return Wrap(child, s.RotateZ(x), Format("rotate (a = %.3f, v = [%s])", x, kAxes[2]));
+        }
+      }
+      case 11: {
+        LinearExtrudeParams params;
+        params.height = Real(0.5, 20);
+        if (Bool()) {
+          params.twist = x;
+          params.convexity = Int(1, 10);
+          params.slices = Int(1, 40);
+          params.scale = w + 0.5;
+          params.center = Bool();
+        }
+        std::string name = Format(
+            "linear_extrude (height = %.3f, center = %s, convexity = %.3f, twist = %.3f, "
+            "slices = %d, scale = %.3f)",
+            params.height,
+            BoolText(params.center),
+            params.convexity,
+            params.twist,
+            params.slices,
+            params.scale);
+        bool defaults = params.twist == 0 && params.slices == 20 && params.scale == 1 &&
+                        params.convexity == 10 && params.center;
+        return Wrap(child,
+                    defaults && Bool() ? s.LinearExtrude(params.height) : s.LinearExtrude(params),
+                    name);
+      }
+      case 12: {
+        auto name = [](double r, double g, double b, double a) {
+          return Format("color (c = [%.3f, %.3f, %.3f, %.3f])", r, g, b, a);
+        };
+        switch (Int(0, 3)) {
+          case 0:
+            return Wrap(child, s.Color(w, w / 2, 1 - w), name(w, w / 2, 1 - w, 1));
+          case 1:
+            return Wrap(child, s.Color(w, w, w, w), name(w, w, w, w));
+          case 2:
+            return Wrap(child, s.Color("red", w), Format("color (\"red\", %f)", w));
+          default:
+            return Wrap(child, s.Alpha(w), Format("color (alpha = %.3f)", w));
+        }
+      }
+      case 13: {
+        Sample other = Make(depth + 1);
+        switch (Int(0, 3)) {
+          case 0:
+            return {s.Subtract(other.shape),
+                    MakeRef(Ref::COMPOSITE, "difference ()", {child.ref, other.ref})};
+          case 1:
+            return {s - other.shape,
+                    MakeRef(Ref::COMPOSITE, "difference ()", {child.ref, other.ref})};
+          case 2: {
+            Shape shape = s;
+            shape -= other.shape;
+            return {shape, MakeRef(Ref::COMPOSITE, "difference ()", {child.ref, other.ref})};
+          }
+          default: {
+            Shape shape = s;
+            shape += other.shape;
+            return {shape, MakeRef(Ref::COMPOSITE, "union ()", {child.ref, other.ref})};
+          }
+        }
+      }
+      case 14: {
+        Sample other = Make(depth + 1);
+        Shape shape = Bool() ? s.Add(other.shape) : s + other.shape;
+        return {shape, MakeRef(Ref::COMPOSITE, "union ()", {child.ref, other.ref})};
+      }
+      case 15:
+        if (Bool()) {
+          return Wrap(child, s.Scale(x, y, z), Format("scale ([%.3f, %.3f, %.3f])", x, y, z));
+        }
+        return Wrap(child, s.Scale(x), Format("scale ([%.3f, %.3f, %.3f])", x, x, x));
+      case 16: {
+        bool chamfer = Bool();
+        if (Bool()) {
+          return Wrap(child,
+                      s.OffsetRadius(w, chamfer),
+                      Format("offset (r = %.3f, chamfer = %s)", w, BoolText(chamfer)));
+        }
+        return Wrap(child,
+                    s.OffsetDelta(w, chamfer),
+                    Format("offset (delta = %.3f, chamfer = %s)", w, BoolText(chamfer)));
+      }
+      case 17: {
+        std::string comment = Format("note %d", Int(0, 99));
+        return {s.Comment(comment), MakeRef(Ref::COMMENT, comment, {child.ref})};
+      }
+      case 18: {
+        bool cut = Bool();
+        return Wrap(child, s.Projection(cut), Format("projection (cut = %s)", BoolText(cut)));
+      }
+      case 19:
+        return {s.Prerender(), MakeRef(Ref::PASS, "", {child.ref})};
+      default: {
+        // Few names so different modules collide and get renamed.
+        std::string name = Format("part_%d", Int(0, 2));
+        return {Module(name, s), MakeRef(Ref::PASS, "", {child.ref})};
+      }
+    }
+  }
+
+  std::mt19937 random_;
+  int max_depth_;
+  std::vector<Sample> pool_;
+};
+
+class Checker {
+ public:
+  Checker(uint32_t seed, int iteration) : seed_(seed), iteration_(iteration) {
+  }
+
+  bool failed() const {
+    return failed_;
+  }
+
+  void Expect(const char* check, const std::string& expected, const std::string& actual) {
+    if (failed_ || expected == actual) {
+      return;
+    }
+    size_t line = 1;
+    size_t at = 0;
+    while (at < expected.size() && at < actual.size() && expected[at] == actual[at]) {
+      line += expected[at] == '\n';
+      ++at;
+    }
+    auto line_at = [&](const std::string& text) {
+      size_t start = text.rfind('\n', at == 0 ? 0 : at - 1);
+      start = start == std::string::npos || at == 0 ? 0 : start + 1;
+      return text.substr(start, text.find('\n', start) - start);
+    };
+    Fail(check,
+         Format("first difference on line %zu\n  expected: %s\n  actual:   %s",
+                line,
+                line_at(expected).c_str(),
+                line_at(actual).c_str()));
+  }
+
+  void ExpectTrue(const char* check, bool condition, const std::string& detail) {
+    if (!failed_ && !condition) {
+      Fail(check, detail);
+    }
+  }
+
+ private:
+  void Fail(const char* check, const std::string& detail) {
+    failed_ = true;
+    fprintf(stderr,
+            "FAILED %s (--seed %u, iteration %d)\n%s\n",
+            check,
+            seed_,
+            iteration_,
+            detail.c_str());
+  }
+
+  uint32_t seed_;
+  int iteration_;
+  bool failed_ = false;
+};
+
+// A file in the temp directory for the WriteToFile check, named after the process and seed so
+// concurrent runs do not overwrite each other's output.
+std::string CheckFileName(uint32_t seed) {
+  std::error_code error;
+  std::filesystem::path directory = std::filesystem::temp_directory_path(error);
+  std::string name = Format("scad_fuzz_%d_%u.scad", static_cast<int>(getpid()), seed);
+  return error ? name : (directory / name).string();
+}
+
+void CheckShape(const Sample& sample, const std::string& file_name, Checker* checker) {
+  const Shape& shape = sample.shape;
+  std::string expected = RefText(sample.ref);
+
+  std::string inline_text = Render([&](std::FILE* file) { shape.AppendScad(file, 0); });
+  checker->Expect("AppendScad", expected, inline_text);
+  checker->Expect("AppendScad indented",
+                  RefText(sample.ref, 3),
+                  Render([&](std::FILE* file) { shape.AppendScad(file, 3); }));
+
+  std::string scad = shape.ToScad();
+  checker->Expect("ToScad with modules inlined", expected, InlineModules(scad));
+  checker->Expect("ToScad deterministic", scad, shape.ToScad());
+
+  shape.WriteToFile(file_name);
+  if (std::FILE* file = fopen(file_name.c_str(), "r")) {
+    checker->Expect("WriteToFile", scad, ReadFile(file));
+    fclose(file);
+  } else {
+    checker->ExpectTrue("WriteToFile", false, Format("unable to read %s", file_name.c_str()));
+  }
+  remove(file_name.c_str());
+
+  Shape prerendered = shape.Prerender();
+  checker->Expect("Prerender",
+                  RefText(sample.ref, 2),
+                  Render([&](std::FILE* file) { prerendered.AppendScad(file, 2); }));
+  checker->Expect("Prerender ToScad", expected, prerendered.ToScad());
+
+  ShapeStats stats = shape.Stats(3);
+  size_t kind_total = 0;
+  for (size_t count : stats.kind_counts) {
+    kind_total += count;
+  }
+  checker->ExpectTrue("Stats emitted bytes",
+                      stats.emitted_bytes == scad.size(),
+                      Format("%zu != %zu", stats.emitted_bytes, scad.size()));
+  checker->ExpectTrue("Stats kind counts",
+                      kind_total == stats.num_nodes,
+                      Format("%zu != %zu", kind_total, stats.num_nodes));
+  checker->Expect("ToScad after Stats", scad, shape.ToScad());
+
+  double cost = EstimateRenderCost(shape).total_cost;
+  double repeated_cost = EstimateRenderCost(shape).total_cost;
+  checker->ExpectTrue("EstimateRenderCost",
+                      std::isfinite(cost) && cost >= 0 && cost == repeated_cost,
+                      Format("cost %f, then %f", cost, repeated_cost));
+}
+
+void CheckMesh(const Mesh& mesh, Checker* checker) {
+  std::string text = mesh.ToShape().ToScad();
+  Mesh parsed;
+  if (!ParsePolyhedron(text, &parsed)) {
+    checker->ExpectTrue("Polyhedron parse", false, text.substr(0, 200));
+    return;
+  }
+  checker->ExpectTrue("Polyhedron faces", parsed.faces == mesh.faces, "faces differ");
+  checker->ExpectTrue("Polyhedron points",
+                      parsed.points.size() == mesh.points.size(),
+                      Format("%zu != %zu", parsed.points.size(), mesh.points.size()));
+  if (checker->failed()) {
+    return;
+  }
+  // Points are written with 3 decimals, so each may move by half a thousandth per axis.
+  double max_distance = 0;
+  for (size_t i = 0; i < mesh.points.size(); ++i) {
+    max_distance = std::max<double>(max_distance, glm::length(parsed.points[i] - mesh.points[i]));
+  }
+  checker->ExpectTrue("Polyhedron point distance",
+                      max_distance < 0.0005 * std::sqrt(3.0) + 1e-4,
+                      Format("max distance %f", max_distance));
+  double volume = mesh.Volume();
+  double parsed_volume = parsed.Volume();
+  checker->ExpectTrue("Polyhedron volume",
+                      volume > 0 && std::abs(parsed_volume - volume) <= 1e-3 * volume + 1e-2,
+                      Format("mesh volume %f, written volume %f", volume, parsed_volume));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  uint32_t seed = 1;
+  int iterations = 500;
+  int max_depth = 5;
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+      seed = static_cast<uint32_t>(strtoul(argv[++i], nullptr, 10));
+    } else if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+      iterations = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "--max-depth") == 0 && i + 1 < argc) {
+      max_depth = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: %s [--seed N] [--iterations N] [--max-depth N]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  const std::string check_file = CheckFileName(seed);
+  for (int i = 0; i < iterations; ++i) {
+    // Every iteration has its own generator so a failure reproduces without the ones before it.
+    Generator generator(seed + i, max_depth);
+    Checker checker(seed, i);
+    CheckShape(generator.Make(), check_file, &checker);
+    CheckMesh(generator.MakeMesh(), &checker);
+    if (checker.failed()) {
+      return 1;
+    }
+  }
+  printf("%d shapes and meshes matched (seed %u)\n", iterations, seed);
+  return 0;
+}
@@ -0,0 +1,214 @@
+#include "alloc_stats.h"
+
+#include <cstdio>
+
+#ifdef SCAD_ALLOC_STATS_ENABLED
+#include <atomic>
+#include <cstdlib>
+#include <new>
+#endif
+
+namespace scad {
+
+const char* AllocationCategoryName(AllocationCategory category) {
+  switch (category) {
+    case AllocationCategory::OTHER:
+      return "other";
+    case AllocationCategory::SHAPE_NODE:
+      return "shape_node";
+    case AllocationCategory::SHAPE_FUNCTION:
+      return "shape_function";
+    case AllocationCategory::SHAPE_CHILDREN:
+      return "shape_children";
+    case AllocationCategory::TRANSFORM_LIST:
+      return "transform_list";
+  }
+  return "other";
+}
+
+void WriteAllocationReport(const AllocationStats& stats, std::FILE* file) {
+  if (!stats.enabled) {
+    fprintf(file, "allocation stats are compiled out (build with -DSCAD_ALLOC_STATS=ON)\n");
+    return;
+  }
+  fprintf(file, "%-16s %12s %14s %14s %14s\n", "category", "count", "bytes", "live", "peak live");
+  auto write_row = [&](const char* name, const AllocationCounters& counters) {
+    fprintf(file,
+            "%-16s %12lld %14lld %14lld %14lld\n",
+            name,
+            static_cast<long long>(counters.count),
+            static_cast<long long>(counters.bytes),
+            static_cast<long long>(counters.live_bytes),
+            static_cast<long long>(counters.peak_live_bytes));
+  };
+  for (int i = 0; i < kNumAllocationCategories; ++i) {
+    write_row(AllocationCategoryName(static_cast<AllocationCategory>(i)), stats.categories[i]);
+  }
+  write_row("total", stats.total);
+}
+
+#ifdef SCAD_ALLOC_STATS_ENABLED
+
+namespace {
+
+struct Counters {
+  std::atomic<int64_t> count{0};
+  std::atomic<int64_t> bytes{0};
+  std::atomic<int64_t> live_bytes{0};
+  std::atomic<int64_t> peak_live_bytes{0};
+
+  void Add(int64_t size) {
+    count.fetch_add(1, std::memory_order_relaxed);
+    bytes.fetch_add(size, std::memory_order_relaxed);
+    int64_t live = live_bytes.fetch_add(size, std::memory_order_relaxed) + size;
+    int64_t peak = peak_live_bytes.load(std::memory_order_relaxed);
+    while (live > peak && !peak_live_bytes.compare_exchange_weak(peak, live)) {
+    }
+  }
+
+  void Remove(int64_t size) {
+    live_bytes.fetch_sub(size, std::memory_order_relaxed);
+  }
+
+  AllocationCounters Get() const {
+    AllocationCounters counters;
+    counters.count = count.load(std::memory_order_relaxed);
+    counters.bytes = bytes.load(std::memory_order_relaxed);
+    counters.live_bytes = live_bytes.load(std::memory_order_relaxed);
+    counters.peak_live_bytes = peak_live_bytes.load(std::memory_order_relaxed);
+    return counters;
+  }
+
+  void Reset() {
+    count = 0;
+    bytes = 0;
+    peak_live_bytes = live_bytes.load();
+  }
+};
+
+// Plain arrays of atomics are constant initialized, so they are usable by allocations made
+// before main.
+Counters category_counters[kNumAllocationCategories];
+Counters total_counters;
+thread_local AllocationCategory current_category = AllocationCategory::OTHER;
+
+// Kept in front of every block. Its size keeps the block aligned for any type.
+struct alignas(alignof(std::max_align_t)) BlockHeader {
+  size_t size;
+  AllocationCategory category;
+};
+
+void* Allocate(size_t size) {
+  auto* header = static_cast<BlockHeader*>(std::malloc(sizeof(BlockHeader) + size));
+  if (header == nullptr) {
+    return nullptr;
+  }
+  header->size = size;
+  header->category = current_category;
+  category_counters[static_cast<int>(header->category)].Add(size);
+  total_counters.Add(size);
+  return header + 1;
+}
+
+void Free(void* p) {
+  if (p == nullptr) {
+    return;
+  }
+  BlockHeader* header = static_cast<BlockHeader*>(p) - 1;
+  category_counters[static_cast<int>(header->category)].Remove(header->size);
+  total_counters.Remove(header->size);
+  std::free(header);
+}
+
+void* AllocateOrThrow(size_t size) {
+  if (void* p = Allocate(size)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+}  // namespace
+
+AllocationScope::AllocationScope(AllocationCategory category) : previous_(current_category) {
+  current_category = category;
+}
+
+AllocationScope::~AllocationScope() {
+  current_category = previous_;
+}
+
+AllocationStats GetAllocationStats() {
+  AllocationStats stats;
+  stats.enabled = true;
+  for (int i = 0; i < kNumAllocationCategories; ++i) {
+    stats.categories[i] = category_counters[i].Get();
+  }
+  stats.total = total_counters.Get();
+  return stats;
+}
+
+void ResetAllocationStats() {
+  for (Counters& counters : category_counters) {
+    counters.Reset();
+  }
+  total_counters.Reset();
+}
+
+#else
+
+AllocationStats GetAllocationStats() {
+  return AllocationStats();
+}
+
+void ResetAllocationStats() {
+}
+
+#endif
+
+}  // namespace scad
+
+#ifdef SCAD_ALLOC_STATS_ENABLED
+
+// Every form which can be paired with another is replaced so no block reaches the wrong delete.
+// The aligned forms are left alone, they are allocated and freed by the standard library.
+void* operator new(size_t size) {
+  return scad::AllocateOrThrow(size);
+}
+
+void* operator new[](size_t size) {
+  return scad::AllocateOrThrow(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+  return scad::Allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+  return scad::Allocate(size);
+}
+
+void operator delete(void* p) noexcept {
+  scad::Free(p);
+}
+
+void operator delete[](void* p) noexcept {
+  scad::Free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+  scad::Free(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+  scad::Free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+  scad::Free(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+  scad::Free(p);
+}
+
+#endif
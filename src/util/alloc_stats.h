@@ -0,0 +1,117 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+
+// Heap accounting by what the memory is used for, compiled in with -DSCAD_ALLOC_STATS=ON. The
+// instrumented build replaces operator new and delete to keep the size and category of every block
+// in a small header, so live and peak bytes can be tracked per category. Allocations are
+// attributed to the innermost SCAD_ALLOCATION_SCOPE on the thread, or to the category of an
+// AccountedAllocator. Without the option the scopes expand to nothing, AccountedAllocator is
+// std::allocator and the stats are all zero.
+
+namespace scad {
+
+enum class AllocationCategory {
+  OTHER,
+  // Shape::Node and its shared_ptr control block.
+  SHAPE_NODE,
+  // Captures of the std::functions writing shapes, including the points of polygons and
+  // polyhedrons.
+  SHAPE_FUNCTION,
+  // The children vectors of composite shapes.
+  SHAPE_CHILDREN,
+  // The vectors of TransformLists.
+  TRANSFORM_LIST,
+};
+const int kNumAllocationCategories = static_cast<int>(AllocationCategory::TRANSFORM_LIST) + 1;
+const char* AllocationCategoryName(AllocationCategory category);
+
+struct AllocationCounters {
+  int64_t count = 0;
+  int64_t bytes = 0;
+  int64_t live_bytes = 0;
+  int64_t peak_live_bytes = 0;
+};
+
+struct AllocationStats {
+  bool enabled = false;
+  std::array<AllocationCounters, kNumAllocationCategories> categories = {};
+  AllocationCounters total;
+};
+
+AllocationStats GetAllocationStats();
+
+// Zeroes the counts and bytes and lowers the peaks to the bytes live now, so a phase can be
+// measured on its own.
+void ResetAllocationStats();
+
+// One line per category with the count, bytes, live and peak live bytes.
+void WriteAllocationReport(const AllocationStats& stats, std::FILE* file);
+
+#ifdef SCAD_ALLOC_STATS_ENABLED
+
+class AllocationScope {
+ public:
+  explicit AllocationScope(AllocationCategory category);
+  ~AllocationScope();
+
+  AllocationScope(const AllocationScope&) = delete;
+  AllocationScope& operator=(const AllocationScope&) = delete;
+
+ private:
+  AllocationCategory previous_;
+};
+
+// Allocates in the scope of category, for containers whose allocations happen in many places.
+template <typename T, AllocationCategory category>
+struct AccountedAllocator {
+  using value_type = T;
+  template <typename U>
+  struct rebind {
+    using other = AccountedAllocator<U, category>;
+  };
+
+  AccountedAllocator() = default;
+  template <typename U>
+  AccountedAllocator(const AccountedAllocator<U, category>&) {
+  }
+
+  T* allocate(size_t n) {
+    AllocationScope scope(category);
+    return static_cast<T*>(::operator new(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t) {
+    ::operator delete(p);
+  }
+
+  template <typename U>
+  bool operator==(const AccountedAllocator<U, category>&) const {
+    return true;
+  }
+  template <typename U>
+  bool operator!=(const AccountedAllocator<U, category>&) const {
+    return false;
+  }
+};
+
+#define SCAD_ALLOC_CONCAT_INNER(a, b) a##b
+#define SCAD_ALLOC_CONCAT(a, b) SCAD_ALLOC_CONCAT_INNER(a, b)
+#define SCAD_ALLOCATION_SCOPE(category)                                        \
+  ::scad::AllocationScope SCAD_ALLOC_CONCAT(scad_allocation_scope_, __LINE__)( \
+      ::scad::AllocationCategory::category)
+
+#else
+
+template <typename T, AllocationCategory category>
+using AccountedAllocator = std::allocator<T>;
+
+#define SCAD_ALLOCATION_SCOPE(category)
+
+#endif
+
+}  // namespace scad
@@ -0,0 +1,359 @@
+#include "clearance.h"
+
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <map>
+#include <vector>
+
+#include "key.h"
+#include "mesh.h"
+#include "trace.h"
+
+namespace scad {
+namespace {
+
+struct Triangle {
+  glm::vec3 p[3];
+  // Index of the mesh, or the index of the key owning the switch holder when is_holder is set.
+  int source;
+  bool is_holder;
+};
+
+struct BvhNode {
+  glm::vec3 min;
+  glm::vec3 max;
+  // Children for interior nodes, -1 for leaves.
+  int left = -1;
+  int right = -1;
+  // Range of triangles for leaves.
+  int first = 0;
+  int count = 0;
+};
+
+const int kMaxLeafSize = 4;
+
+class Bvh {
+ public:
+  explicit Bvh(std::vector<Triangle> triangles) : triangles_(std::move(triangles)) {
+    if (!triangles_.empty()) {
+      Build(0, static_cast<int>(triangles_.size()));
+    }
+  }
+
+  // Calls fn for every triangle whose bounds overlap min, max.
+  template <typename Fn>
+  void Query(const glm::vec3& min, const glm::vec3& max, const Fn& fn) const {
+    if (nodes_.empty()) {
+      return;
+    }
+    std::vector<int> stack = {0};
+    while (!stack.empty()) {
+      const BvhNode& node = nodes_[stack.back()];
+      stack.pop_back();
+      if (glm::any(glm::greaterThan(min, node.max)) || glm::any(glm::lessThan(max, node.min))) {
+        continue;
+      }
+      if (node.left < 0) {
+        for (int i = node.first; i < node.first + node.count; ++i) {
+          fn(triangles_[i]);
+        }
+        continue;
+      }
+      stack.push_back(node.left);
+      stack.push_back(node.right);
+    }
+  }
+
+ private:
+  int Build(int first, int count) {
+    int index = static_cast<int>(nodes_.size());
+    nodes_.emplace_back();
+    BvhNode node;
+    node.min = node.max = triangles_[first].p[0];
+    for (int i = first; i < first + count; ++i) {
+      for (const glm::vec3& p : triangles_[i].p) {
+        node.min = glm::min(node.min, p);
+        node.max = glm::max(node.max, p);
+      }
+    }
+    if (count <= kMaxLeafSize) {
+      node.first = first;
+      node.count = count;
+      nodes_[index] = node;
+      return index;
+    }
+    // Split at the median centroid along the longest axis.
+    glm::vec3 extent = node.max - node.min;
+    int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+    int half = count / 2;
+    std::nth_element(triangles_.begin() + first,
+                     triangles_.begin() + first + half,
+                     triangles_.begin() + first + count,
+                     [axis](const Triangle& a, const Triangle& b) {
+                       return a.p[0][axis] + a.p[1][axis] + a.p[2][axis] <
+                              b.p[0][axis] + b.p[1][axis] + b.p[2][axis];
+                     });
+    node.left = Build(first, half);
+    node.right = Build(first + half, count - half);
+    nodes_[index] = node;
+    return index;
+  }
+
+  std::vector<Triangle> triangles_;
+  std::vector<BvhNode> nodes_;
+};
+
+// Separating axis test between a triangle and the box centered at the origin with half size
+// extents.
+bool TriangleOverlapsBox(const glm::vec3 v[3], const glm::vec3& extents) {
+  const glm::vec3 edges[3] = {v[1] - v[0], v[2] - v[1], v[0] - v[2]};
+  auto separated = [&](const glm::vec3& axis) {
+    if (glm::dot(axis, axis) < 1e-12f) {
+      return false;
+    }
+    float p0 = glm::dot(v[0], axis);
+    float p1 = glm::dot(v[1], axis);
+    float p2 = glm::dot(v[2], axis);
+    float r = extents.x * std::abs(axis.x) + extents.y * std::abs(axis.y) +
+              extents.z * std::abs(axis.z);
+    return std::max({p0, p1, p2}) < -r || std::min({p0, p1, p2}) > r;
+  };
+  for (int i = 0; i < 3; ++i) {
+    glm::vec3 axis(0);
+    axis[i] = 1;
+    if (separated(axis)) {
+      return false;
+    }
+    for (const glm::vec3& edge : edges) {
+      if (separated(glm::cross(axis, edge))) {
+        return false;
+      }
+    }
+  }
+  return !separated(glm::cross(edges[0], edges[1]));
+}
+
+// Clips a polygon to the box centered at the origin with half size extents.
+std::vector<glm::vec3> ClipToBox(std::vector<glm::vec3> polygon, const glm::vec3& extents) {
+  for (int axis = 0; axis < 3; ++axis) {
+    for (float sign : {1.0f, -1.0f}) {
+      std::vector<glm::vec3> clipped;
+      for (size_t i = 0; i < polygon.size(); ++i) {
+        const glm::vec3& a = polygon[i];
+        const glm::vec3& b = polygon[(i + 1) % polygon.size()];
+        // Positive when inside the plane.
+        float da = extents[axis] - sign * a[axis];
+        float db = extents[axis] - sign * b[axis];
+        if (da >= 0) {
+          clipped.push_back(a);
+        }
+        if ((da >= 0) != (db >= 0)) {
+          clipped.push_back(a + (b - a) * (da / (da - db)));
+        }
+      }
+      polygon = std::move(clipped);
+      if (polygon.empty()) {
+        return polygon;
+      }
+    }
+  }
+  return polygon;
+}
+
+// Whether the ray from origin along direction crosses the triangle.
+bool RayHitsTriangle(const glm::vec3& origin, const glm::vec3& direction, const Triangle& t) {
+  glm::vec3 e1 = t.p[1] - t.p[0];
+  glm::vec3 e2 = t.p[2] - t.p[0];
+  glm::vec3 h = glm::cross(direction, e2);
+  float det = glm::dot(e1, h);
+  if (std::abs(det) < 1e-12f) {
+    return false;
+  }
+  glm::vec3 s = origin - t.p[0];
+  float u = glm::dot(s, h) / det;
+  if (u < 0 || u > 1) {
+    return false;
+  }
+  glm::vec3 q = glm::cross(s, e1);
+  float v = glm::dot(direction, q) / det;
+  if (v < 0 || u + v > 1) {
+    return false;
+  }
+  return glm::dot(e2, q) / det > 0;
+}
+
+// Whether point is inside the closed mesh source, by the parity of the triangles a ray from it
+// crosses. The ray is tilted off the axes so it does not run along the edges of boxes.
+bool InsideMesh(const Bvh& bvh, int source, const glm::vec3& point, const glm::vec3& mesh_max) {
+  glm::vec3 direction = glm::normalize(glm::vec3(1, 0.0123f, 0.0371f));
+  glm::vec3 end = point + direction * ((mesh_max.x - point.x + 1) / direction.x);
+  int crossings = 0;
+  bvh.Query(glm::min(point, end), glm::max(point, end), [&](const Triangle& t) {
+    if (!t.is_holder && t.source == source && RayHitsTriangle(point, direction, t)) {
+      ++crossings;
+    }
+  });
+  return crossings % 2 == 1;
+}
+
+float DepthInBox(const glm::vec3& p, const glm::vec3& extents) {
+  glm::vec3 d = extents - glm::abs(p);
+  return std::min({d.x, d.y, d.z});
+}
+
+void AddTriangles(const Mesh& mesh, int source, bool is_holder, std::vector<Triangle>* triangles) {
+  for (const auto& face : mesh.faces) {
+    for (size_t i = 1; i + 1 < face.size(); ++i) {
+      triangles->push_back(
+          {{mesh.points[face[0]], mesh.points[face[i]], mesh.points[face[i + 1]]},
+           source,
+           is_holder});
+    }
+  }
+}
+
+}  // namespace
+
+Mesh MakeSwitchHolderMesh(const Key& key) {
+  double left = -1 * (kSwitchHorizontalOffset + key.extra_width_left);
+  double right = kSwitchHorizontalOffset + key.extra_width_right;
+  double top = kSwitchHorizontalOffset + key.extra_width_top;
+  double bottom = -1 * (kSwitchHorizontalOffset + key.extra_width_bottom);
+  double inner = kSwitchWidth / 2;
+  double z_min = -1 * kSwitchThickness;
+  double z_max = std::max(0.0, key.extra_z);
+
+  glm::mat4 m = key.GetSwitchMatrix();
+  Mesh mesh;
+  mesh.Append(MakeBoxMesh(glm::vec3(left, bottom, z_min), glm::vec3(-inner, top, z_max), m));
+  mesh.Append(MakeBoxMesh(glm::vec3(inner, bottom, z_min), glm::vec3(right, top, z_max), m));
+  mesh.Append(MakeBoxMesh(glm::vec3(-inner, inner, z_min), glm::vec3(inner, top, z_max), m));
+  mesh.Append(MakeBoxMesh(glm::vec3(-inner, bottom, z_min), glm::vec3(inner, -inner, z_max), m));
+  return mesh;
+}
+
+std::vector<Intrusion> FindIntrusions(const std::vector<const Key*>& keys,
+                                      const std::vector<Mesh>& meshes,
+                                      const ClearanceParams& params) {
+  SCAD_TRACE_SCOPE("FindIntrusions");
+  std::vector<Triangle> triangles;
+  std::vector<std::pair<glm::vec3, glm::vec3>> mesh_bounds;
+  for (size_t i = 0; i < meshes.size(); ++i) {
+    AddTriangles(meshes[i], static_cast<int>(i), false, &triangles);
+    glm::vec3 min = meshes[i].points.empty() ? glm::vec3(0) : meshes[i].points[0];
+    glm::vec3 max = min;
+    for (const glm::vec3& p : meshes[i].points) {
+      min = glm::min(min, p);
+      max = glm::max(max, p);
+    }
+    mesh_bounds.push_back({min, max});
+  }
+  if (params.check_switch_holders) {
+    for (size_t i = 0; i < keys.size(); ++i) {
+      AddTriangles(MakeSwitchHolderMesh(*keys[i]), static_cast<int>(i), true, &triangles);
+    }
+  }
+  Bvh bvh(std::move(triangles));
+
+  std::vector<Intrusion> intrusions;
+  for (size_t k = 0; k < keys.size(); ++k) {
+    const Key& key = *keys[k];
+    // The clearance box in switch space, see Key::GetInverseCap.
+    double width = kDsaBottomSize + .1;
+    double length = params.custom_vertical_length > 0 ? params.custom_vertical_length : width;
+    glm::vec3 extents(width / 2, length / 2, 15);
+    glm::vec3 center(0, 0, key.extra_z + 15);
+
+    std::vector<glm::vec3> corners = key.GetInverseCapPoints(params.custom_vertical_length);
+    glm::vec3 min = corners[0];
+    glm::vec3 max = corners[0];
+    for (const glm::vec3& p : corners) {
+      min = glm::min(min, p);
+      max = glm::max(max, p);
+    }
+
+    // Deepest intrusion for each source, keyed by (is_holder, source).
+    std::map<std::pair<bool, int>, Intrusion> deepest;
+    glm::mat4 to_world = key.GetSwitchMatrix();
+    glm::mat4 to_local = key.GetInverseSwitchMatrix();
+    bvh.Query(min, max, [&](const Triangle& t) {
+      if (t.is_holder && t.source == static_cast<int>(k)) {
+        return;
+      }
+      glm::vec3 local[3];
+      for (int i = 0; i < 3; ++i) {
+        local[i] = glm::vec3(to_local * glm::vec4(t.p[i], 1)) - center;
+      }
+      if (!TriangleOverlapsBox(local, extents)) {
+        return;
+      }
+      std::vector<glm::vec3> inside = ClipToBox({local[0], local[1], local[2]}, extents);
+      if (inside.empty()) {
+        return;
+      }
+      glm::vec3 centroid(0);
+      for (const glm::vec3& p : inside) {
+        centroid += p;
+      }
+      inside.push_back(centroid / static_cast<float>(inside.size()));
+      float depth = -1;
+      glm::vec3 location(0);
+      for (const glm::vec3& p : inside) {
+        float d = DepthInBox(p, extents);
+        if (d > depth) {
+          depth = d;
+          location = p;
+        }
+      }
+      if (depth <= params.tolerance) {
+        return;
+      }
+      Intrusion& intrusion = deepest[{t.is_holder, t.source}];
+      if (depth > intrusion.depth) {
+        intrusion.key = &key;
+        intrusion.mesh_index = t.is_holder ? -1 : t.source;
+        intrusion.other_key = t.is_holder ? keys[t.source] : nullptr;
+        intrusion.depth = depth;
+        intrusion.location = glm::vec3(to_world * glm::vec4(location + center, 1));
+      }
+    });
+    glm::vec3 world_center(to_world * glm::vec4(center, 1));
+    for (size_t i = 0; i < meshes.size(); ++i) {
+      const auto& bounds = mesh_bounds[i];
+      if (deepest.count({false, static_cast<int>(i)}) > 0 ||
+          glm::any(glm::lessThan(world_center, bounds.first)) ||
+          glm::any(glm::greaterThan(world_center, bounds.second)) ||
+          !InsideMesh(bvh, static_cast<int>(i), world_center, bounds.second)) {
+        continue;
+      }
+      Intrusion& intrusion = deepest[{false, static_cast<int>(i)}];
+      intrusion.key = &key;
+      intrusion.mesh_index = static_cast<int>(i);
+      intrusion.depth = std::min({extents.x, extents.y, extents.z});
+      intrusion.location = world_center;
+    }
+    for (const auto& entry : deepest) {
+      intrusions.push_back(entry.second);
+    }
+  }
+  return intrusions;
+}
+
+void PrintIntrusions(const std::vector<Intrusion>& intrusions, std::FILE* file) {
+  for (const Intrusion& i : intrusions) {
+    if (i.other_key) {
+      fprintf(file, "%s: switch holder of %s", i.key->name.c_str(), i.other_key->name.c_str());
+    } else {
+      fprintf(file, "%s: mesh %d", i.key->name.c_str(), i.mesh_index);
+    }
+    fprintf(file,
+            " intrudes %.3f mm at [%.3f, %.3f, %.3f]\n",
+            i.depth,
+            i.location.x,
+            i.location.y,
+            i.location.z);
+  }
+}
+
+}  // namespace scad
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstdio>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "key.h"
+#include "mesh.h"
+
+namespace scad {
+
+// The walls of the switch holder made by Key::GetSwitch (including the extra_width_* area) as
+// boxes. The nubs are left out.
+Mesh MakeSwitchHolderMesh(const Key& key);
+
+// Something reaching into the space a key cap travels through (Key::GetInverseCap).
+struct Intrusion {
+  const Key* key = nullptr;
+  // Index into the meshes passed to FindIntrusions, or -1 if it is another key's switch holder.
+  int mesh_index = -1;
+  const Key* other_key = nullptr;
+  // How far into the clearance volume the geometry reaches in mm, measured to the nearest face of
+  // the volume, and the world position where that was found. The depth is evaluated at the
+  // vertices and the centroid of each intruding triangle clipped to the volume.
+  double depth = 0;
+  glm::vec3 location = glm::vec3(0);
+};
+
+struct ClearanceParams {
+  // Passed on to Key::GetInverseCap.
+  double custom_vertical_length = -1;
+  // Also test every key against the switch holders of the other keys.
+  bool check_switch_holders = true;
+  // Intrusions no deeper than this are ignored, so touching faces are not reported.
+  double tolerance = 1e-3;
+};
+
+// Tests the clearance volume of every key against the triangles of meshes (walls, webs etc.).
+// Triangles are kept in a bounding volume hierarchy so each key only tests the triangles near it.
+// A clearance volume lying entirely inside a mesh crosses none of its triangles, so meshes no
+// triangle reached are also tested for containing the center of the volume, which needs them to
+// be closed. At most one intrusion, the deepest, is reported per key and source.
+std::vector<Intrusion> FindIntrusions(const std::vector<const Key*>& keys,
+                                      const std::vector<Mesh>& meshes,
+                                      const ClearanceParams& params = {});
+
+void PrintIntrusions(const std::vector<Intrusion>& intrusions, std::FILE* file = stdout);
+
+}  // namespace scad
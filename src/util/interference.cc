@@ -0,0 +1,286 @@
+#include "interference.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "key.h"
+#include "trace.h"
+
+namespace scad {
+namespace {
+
+using Vec = glm::dvec3;
+
+const double kEpsilon = 1e-10;
+
+Vec Support(const ConvexVolume& v, const Vec& direction) {
+  const glm::vec3* best = &v.points[0];
+  double best_dot = glm::dot(Vec(*best), direction);
+  for (const glm::vec3& p : v.points) {
+    double d = glm::dot(Vec(p), direction);
+    if (d > best_dot) {
+      best_dot = d;
+      best = &p;
+    }
+  }
+  return Vec(*best);
+}
+
+// Support point of the Minkowski difference a - b.
+Vec Support(const ConvexVolume& a, const ConvexVolume& b, const Vec& direction) {
+  return Support(a, direction) - Support(b, -1.0 * direction);
+}
+
+bool IsZero(const Vec& v) {
+  return glm::dot(v, v) < kEpsilon * kEpsilon;
+}
+
+// The simplex holds up to 4 points with the most recently added point last. Each step reduces the
+// simplex to the feature closest to the origin and sets the next search direction. Returns true if
+// the origin is inside (or on) the simplex.
+bool DoLine(std::vector<Vec>& simplex, Vec& direction) {
+  Vec a = simplex[1];
+  Vec b = simplex[0];
+  Vec ab = b - a;
+  Vec ao = -1.0 * a;
+  if (glm::dot(ab, ao) > 0) {
+    direction = glm::cross(glm::cross(ab, ao), ab);
+    return IsZero(direction);
+  }
+  simplex = {a};
+  direction = ao;
+  return false;
+}
+
+bool DoTriangle(std::vector<Vec>& simplex, Vec& direction) {
+  Vec a = simplex[2];
+  Vec b = simplex[1];
+  Vec c = simplex[0];
+  Vec ab = b - a;
+  Vec ac = c - a;
+  Vec ao = -1.0 * a;
+  Vec abc = glm::cross(ab, ac);
+
+  if (glm::dot(glm::cross(abc, ac), ao) > 0) {
+    if (glm::dot(ac, ao) > 0) {
+      simplex = {c, a};
+      direction = glm::cross(glm::cross(ac, ao), ac);
+      return IsZero(direction);
+    }
+    simplex = {b, a};
+    return DoLine(simplex, direction);
+  }
+  if (glm::dot(glm::cross(ab, abc), ao) > 0) {
+    simplex = {b, a};
+    return DoLine(simplex, direction);
+  }
+  double side = glm::dot(abc, ao);
+  if (std::abs(side) < kEpsilon) {
+    return true;
+  }
+  if (side > 0) {
+    direction = abc;
+  } else {
+    simplex = {b, c, a};
+    direction = -1.0 * abc;
+  }
+  return false;
+}
+
+bool DoTetrahedron(std::vector<Vec>& simplex, Vec& direction) {
+  Vec a = simplex[3];
+  Vec b = simplex[2];
+  Vec c = simplex[1];
+  Vec d = simplex[0];
+  Vec ao = -1.0 * a;
+  // Each face containing a along with the vertex opposite it.
+  const Vec faces[3][3] = {{b, c, d}, {c, d, b}, {d, b, c}};
+  for (const auto& face : faces) {
+    Vec normal = glm::cross(face[0] - a, face[1] - a);
+    if (glm::dot(normal, face[2] - a) > 0) {
+      normal = -1.0 * normal;
+    }
+    if (glm::dot(normal, ao) > 0) {
+      simplex = {face[1], face[0], a};
+      return DoTriangle(simplex, direction);
+    }
+  }
+  return true;
+}
+
+bool DoSimplex(std::vector<Vec>& simplex, Vec& direction) {
+  switch (simplex.size()) {
+    case 2:
+      return DoLine(simplex, direction);
+    case 3:
+      return DoTriangle(simplex, direction);
+    default:
+      return DoTetrahedron(simplex, direction);
+  }
+}
+
+bool BoundsOverlap(const ConvexVolume& a, const ConvexVolume& b) {
+  return a.min.x <= b.max.x && b.min.x <= a.max.x && a.min.y <= b.max.y && b.min.y <= a.max.y &&
+         a.min.z <= b.max.z && b.min.z <= a.max.z;
+}
+
+// Reports every overlapping pair of volumes. Volumes are bucketed into a uniform grid of cells at
+// least as large as the biggest volume, so each volume lands in at most 8 cells and only volumes
+// sharing a cell are compared.
+void AddInterferences(const std::vector<const Key*>& keys,
+                      const std::vector<ConvexVolume>& volumes,
+                      InterferenceType type,
+                      double tolerance,
+                      std::vector<std::pair<std::pair<size_t, size_t>, Interference>>* results) {
+  float cell_size = 0;
+  for (const ConvexVolume& v : volumes) {
+    glm::vec3 extent = v.max - v.min;
+    cell_size = std::max({cell_size, extent.x, extent.y, extent.z});
+  }
+  if (cell_size <= 0) {
+    cell_size = 1;
+  }
+
+  auto cell_key = [](int64_t x, int64_t y, int64_t z) {
+    return ((x & 0x1FFFFF) << 42) | ((y & 0x1FFFFF) << 21) | (z & 0x1FFFFF);
+  };
+  std::unordered_map<int64_t, std::vector<size_t>> cells;
+  for (size_t i = 0; i < volumes.size(); ++i) {
+    glm::ivec3 lo(glm::floor(volumes[i].min / cell_size));
+    glm::ivec3 hi(glm::floor(volumes[i].max / cell_size));
+    for (int x = lo.x; x <= hi.x; ++x) {
+      for (int y = lo.y; y <= hi.y; ++y) {
+        for (int z = lo.z; z <= hi.z; ++z) {
+          cells[cell_key(x, y, z)].push_back(i);
+        }
+      }
+    }
+  }
+
+  std::unordered_set<uint64_t> tested;
+  for (const auto& cell : cells) {
+    const std::vector<size_t>& members = cell.second;
+    for (size_t m = 0; m < members.size(); ++m) {
+      for (size_t n = m + 1; n < members.size(); ++n) {
+        size_t i = std::min(members[m], members[n]);
+        size_t j = std::max(members[m], members[n]);
+        if (!tested.insert((static_cast<uint64_t>(i) << 32) | j).second) {
+          continue;
+        }
+        if (BoundsOverlap(volumes[i], volumes[j]) &&
+            Intersects(volumes[i], volumes[j], tolerance)) {
+          results->push_back({{i, j}, {keys[i], keys[j], type}});
+        }
+      }
+    }
+  }
+}
+
+const char* InterferenceTypeName(InterferenceType type) {
+  switch (type) {
+    case InterferenceType::CAP:
+      return "cap";
+    case InterferenceType::TRAVEL:
+      return "travel";
+  }
+  return "";
+}
+
+}  // namespace
+
+ConvexVolume::ConvexVolume(std::vector<glm::vec3> in) : points(std::move(in)) {
+  min = max = points.empty() ? glm::vec3(0) : points[0];
+  for (const glm::vec3& p : points) {
+    min = glm::min(min, p);
+    max = glm::max(max, p);
+  }
+}
+
+glm::vec3 ConvexVolume::Support(const glm::vec3& direction) const {
+  return glm::vec3(scad::Support(*this, Vec(direction)));
+}
+
+bool Intersects(const ConvexVolume& a, const ConvexVolume& b, double tolerance) {
+  if (a.points.empty() || b.points.empty()) {
+    return false;
+  }
+  Vec direction = Vec((a.min + a.max) * 0.5f - (b.min + b.max) * 0.5f);
+  if (IsZero(direction)) {
+    direction = Vec(1, 0, 0);
+  }
+  // Runs GJK on the difference of the volumes with each support point pulled in by tolerance along
+  // the search direction, so volumes which overlap by about tolerance or less are kept apart.
+  auto support = [&](const Vec& d) {
+    Vec unit = glm::normalize(d);
+    return Support(a, b, unit) - tolerance * unit;
+  };
+  std::vector<Vec> simplex = {support(direction)};
+  direction = -1.0 * simplex[0];
+  // GJK converges in a handful of steps for boxes and caps. If it ever fails to converge the
+  // volumes are too close to tell apart, which is reported as an interference rather than
+  // letting a possible overlap through.
+  for (int i = 0; i < 64; ++i) {
+    if (IsZero(direction)) {
+      return true;
+    }
+    direction = glm::normalize(direction);
+    Vec p = support(direction);
+    if (glm::dot(p, direction) < 0) {
+      return false;
+    }
+    simplex.push_back(p);
+    if (DoSimplex(simplex, direction)) {
+      return true;
+    }
+  }
+  return true;
+}
+
+std::vector<Interference> FindInterferences(const std::vector<const Key*>& keys,
+                                            const InterferenceParams& params) {
+  SCAD_TRACE_SCOPE("FindInterferences");
+  std::vector<std::pair<std::pair<size_t, size_t>, Interference>> results;
+  if (params.check_caps) {
+    std::vector<ConvexVolume> caps;
+    caps.reserve(keys.size());
+    for (const Key* key : keys) {
+      caps.emplace_back(key->GetCapPoints());
+    }
+    AddInterferences(keys, caps, InterferenceType::CAP, params.tolerance, &results);
+  }
+  if (params.check_travel) {
+    std::vector<ConvexVolume> travel;
+    travel.reserve(keys.size());
+    for (const Key* key : keys) {
+      travel.emplace_back(key->GetInverseCapPoints());
+    }
+    AddInterferences(keys, travel, InterferenceType::TRAVEL, params.tolerance, &results);
+  }
+
+  std::stable_sort(results.begin(), results.end(), [](const auto& x, const auto& y) {
+    return x.first < y.first;
+  });
+  std::vector<Interference> interferences;
+  interferences.reserve(results.size());
+  for (const auto& result : results) {
+    interferences.push_back(result.second);
+  }
+  return interferences;
+}
+
+void PrintInterferences(const std::vector<Interference>& interferences, std::FILE* file) {
+  for (const Interference& i : interferences) {
+    fprintf(file,
+            "%s interference: %s - %s\n",
+            InterferenceTypeName(i.type),
+            i.a->name.c_str(),
+            i.b->name.c_str());
+  }
+}
+
+}  // namespace scad
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdio>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "key.h"
+
+namespace scad {
+
+// A convex volume given by points, the volume is their convex hull.
+struct ConvexVolume {
+  ConvexVolume() {
+  }
+  explicit ConvexVolume(std::vector<glm::vec3> points);
+
+  std::vector<glm::vec3> points;
+  // Axis aligned bounds of the points.
+  glm::vec3 min;
+  glm::vec3 max;
+
+  // The point furthest along direction.
+  glm::vec3 Support(const glm::vec3& direction) const;
+};
+
+// Convex vs convex test (GJK) on the hulls of the points. Each support point is pulled in by
+// tolerance in mm along its search direction, so volumes touching within about tolerance do not
+// count as intersecting. This approximates shrinking the volumes and is exact only along the
+// directions GJK searches. With a tolerance of zero touching volumes intersect. If the search does
+// not converge the volumes are reported as intersecting, the safe answer for a clearance check.
+bool Intersects(const ConvexVolume& a, const ConvexVolume& b, double tolerance = 1e-3);
+
+enum class InterferenceType {
+  // The key caps (Key::GetCap) overlap.
+  CAP,
+  // The space the caps travel through (Key::GetInverseCap) overlap.
+  TRAVEL,
+};
+
+struct Interference {
+  const Key* a;
+  const Key* b;
+  InterferenceType type;
+};
+
+struct InterferenceParams {
+  bool check_caps = true;
+  bool check_travel = true;
+  // Passed on to Intersects, volumes which overlap by no more than this are not reported.
+  double tolerance = 1e-3;
+};
+
+// Every pair of keys whose caps or cap travel volumes intersect. Candidate pairs come from a
+// uniform spatial hash over the volumes' bounding boxes and are then tested exactly with
+// Intersects, so this runs in process in well under the time of a render. Results are ordered by
+// the index of a then b in keys.
+std::vector<Interference> FindInterferences(const std::vector<const Key*>& keys,
+                                            const InterferenceParams& params = {});
+
+// Writes one line per interference using the key names.
+void PrintInterferences(const std::vector<Interference>& interferences, std::FILE* file = stdout);
+
+}  // namespace scad
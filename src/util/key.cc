@@ -1,11 +1,17 @@
 #include "key.h"
 
+#include <algorithm>
+#include <array>
 #include <cassert>
+#include <cmath>
+#include <map>
 #include <memory>
 #include <unordered_set>
 #include <vector>
 
+#include "mesh.h"
 #include "scad.h"
+#include "trace.h"
 #include "transform.h"
 
 namespace scad {
@@ -13,127 +19,436 @@ namespace {
 
 const double kDsaSwitchZOffset = kDsaHeight + 6.4;
 const double kSaSwitchZOffset = kSaHeight + 6.4;
+const double kPostHeight = 3.5;
+// The width of the default post connector.
+const double kPostWidth = .01;
 
-struct CapSegment {
-  double height;
-  double width;
+enum Corner { TOP_LEFT = 0, TOP_RIGHT, BOTTOM_RIGHT, BOTTOM_LEFT };
+
+struct CornerRef {
+  const Key* key;
+  Corner corner;
 };
 
-// Segments from bottom to top.
-Shape MakeCap(const std::vector<CapSegment>& segments) {
-  std::vector<Shape> shapes;
-  double height_so_far = 0;
-  for (int i = 0; i < segments.size() - 1; ++i) {
-    double bottom_width = segments[i].width;
-    double top_width = segments[i + 1].width;
-    LinearExtrudeParams p;
-    p.height = segments[i].height;
-    p.scale = top_width / bottom_width;
-    height_so_far += p.height;
-    shapes.push_back(Square(bottom_width)
-                         .LinearExtrude(p)
-                         .TranslateZ(-0.5 * p.height)
-                         .TranslateZ(height_so_far));
-  }
-  return UnionAll(shapes).TranslateZ(-1 * height_so_far);
-}
-
-// Expects the edge to be on the bottom.
-Shape RotateCapEdge(Shape s, SaEdgeType edge_type) {
-  switch (edge_type) {
-    case SaEdgeType::LEFT:
-      return s.RotateZ(-90);
-    case SaEdgeType::RIGHT:
-      return s.RotateZ(90);
-    case SaEdgeType::TOP:
-      return s.RotateZ(180);
-    case SaEdgeType::BOTTOM:
-      return s;
+// A slab under the quad a, b, c, d split along a-c, like the two hulls made by the Connect
+// functions.
+Shape MakeConnectorSlab(CornerRef a, CornerRef b, CornerRef c, CornerRef d, double offset) {
+  SlabBuilder builder;
+  int indices[4];
+  CornerRef refs[4] = {a, b, c, d};
+  for (int i = 0; i < 4; ++i) {
+    const Key& key = *refs[i].key;
+    indices[i] = builder.AddVertex(key.GetCornerPoints(offset)[refs[i].corner],
+                                   key.GetCornerPoints(offset, -kPostHeight)[refs[i].corner]);
   }
+  builder.AddTriangle(indices[0], indices[1], indices[2]);
+  builder.AddTriangle(indices[2], indices[3], indices[0]);
+  return builder.Build().ToShape();
 }
 
-}  // namespace
+// A triangle of default posts standing close to parallel with them, as the thin prism its hull
+// makes: the outline of the post ends in the plane the posts stand in, as thick as they spread out
+// of that plane but at least as thick as a post. For posts that are exactly in the plane this is
+// their hull, otherwise it is up to that spread thicker.
+Mesh MakeWallSlab(const std::array<glm::vec3, 6>& points, glm::vec3 normal, glm::vec3 up) {
+  up = glm::normalize(up);
+  normal = glm::normalize(normal - glm::dot(normal, up) * up);
+  glm::vec3 across = glm::cross(normal, up);
+  std::vector<glm::vec2> outline;
+  float min_depth = glm::dot(normal, points[0]);
+  float max_depth = min_depth;
+  for (const glm::vec3& p : points) {
+    outline.push_back({glm::dot(up, p), glm::dot(across, p)});
+    min_depth = std::min(min_depth, glm::dot(normal, p));
+    max_depth = std::max(max_depth, glm::dot(normal, p));
+  }
+  float grow = std::max(0.f, static_cast<float>(kPostWidth) - (max_depth - min_depth)) / 2;
+  min_depth -= grow;
+  max_depth += grow;
 
-Shape MakeSwitch(bool add_side_nub, bool add_top_nub) {
-  std::vector<Shape> shapes;
-  Shape top_wall = Cube(kSwitchWidth + kWallWidth * 2, kWallWidth, kSwitchThickness)
-                       .Translate(0, kWallWidth / 2 + kSwitchWidth / 2, kSwitchThickness / 2);
+  // Monotone chain hull of the outline, counter clockwise.
+  std::sort(outline.begin(), outline.end(), [](const glm::vec2& a, const glm::vec2& b) {
+    return a.x < b.x || (a.x == b.x && a.y < b.y);
+  });
+  auto turn = [](const glm::vec2& o, const glm::vec2& a, const glm::vec2& b) {
+    return (a.x - o.x) * (b.y - o.y) - (a.y - o.y) * (b.x - o.x);
+  };
+  std::vector<glm::vec2> hull;
+  for (int pass = 0; pass < 2; ++pass) {
+    size_t start = hull.size();
+    for (const glm::vec2& p : outline) {
+      while (hull.size() >= start + 2 && turn(hull[hull.size() - 2], hull.back(), p) <= 0) {
+        hull.pop_back();
+      }
+      hull.push_back(p);
+    }
+    hull.pop_back();
+    std::reverse(outline.begin(), outline.end());
+  }
 
-  shapes.push_back(top_wall);
-  shapes.push_back(top_wall.RotateZ(90));
-  shapes.push_back(top_wall.RotateZ(180));
-  shapes.push_back(top_wall.RotateZ(270));
+  SlabBuilder builder;
+  for (const glm::vec2& p : hull) {
+    glm::vec3 base = p.x * up + p.y * across;
+    builder.AddVertex(base + max_depth * normal, base + min_depth * normal);
+  }
+  for (int i = 2; i < static_cast<int>(hull.size()); ++i) {
+    builder.AddTriangle(0, i - 1, i);
+  }
+  return builder.Build();
+}
+
+// Triangles between default post connectors as one slab. Triangles standing close to parallel with
+// their posts would give a slab with no thickness, those are each made by MakeWallSlab instead.
+Shape MakePostSlab(const std::vector<TransformList>& transforms,
+                   const std::vector<glm::ivec3>& triangles) {
+  SlabBuilder builder;
+  std::vector<glm::vec3> tops;
+  std::vector<glm::vec3> bottoms;
+  std::vector<int> indices;
+  for (const TransformList& t : transforms) {
+    glm::mat4 m = t.GetMatrix();
+    glm::vec3 top(m * glm::vec4(0, 0, 0, 1));
+    glm::vec3 bottom(m * glm::vec4(0, 0, -kPostHeight, 1));
+    // Repeated posts share a vertex so the triangles around them are welded.
+    int index = -1;
+    for (size_t i = 0; i < tops.size(); ++i) {
+      if (tops[i] == top && bottoms[i] == bottom) {
+        index = indices[i];
+        break;
+      }
+    }
+    if (index < 0) {
+      index = builder.AddVertex(top, bottom);
+    }
+    tops.push_back(top);
+    bottoms.push_back(bottom);
+    indices.push_back(index);
+  }
+
+  std::vector<Shape> slabs;
+  for (const glm::ivec3& t : triangles) {
+    glm::vec3 normal = glm::cross(tops[t.y] - tops[t.x], tops[t.z] - tops[t.x]);
+    glm::vec3 up = (tops[t.x] - bottoms[t.x]) + (tops[t.y] - bottoms[t.y]) +
+                   (tops[t.z] - bottoms[t.z]);
+    float length = glm::length(normal) * glm::length(up);
+    if (length > 0 && std::abs(glm::dot(normal, up)) < 0.1f * length) {
+      Mesh wall = MakeWallSlab(
+          {tops[t.x], tops[t.y], tops[t.z], bottoms[t.x], bottoms[t.y], bottoms[t.z]}, normal, up);
+      if (!wall.empty()) {
+        slabs.push_back(wall.ToShape());
+      }
+      continue;
+    }
+    builder.AddTriangle(indices[t.x], indices[t.y], indices[t.z]);
+  }
+  Mesh mesh = builder.Build();
+  if (!mesh.empty()) {
+    slabs.push_back(mesh.ToShape());
+  }
+  return slabs.size() == 1 ? slabs[0] : UnionAll(slabs);
+}
+
+double GetSwitchZOffset(KeyType type) {
+  return type == KeyType::DSA ? kDsaSwitchZOffset : kSaSwitchZOffset;
+}
 
+// The nubs of the switch holder, with the holder's bottom at z = 0.
+void AddSwitchNubs(bool add_side_nub, bool add_top_nub, std::vector<Shape>* shapes) {
   if (add_side_nub) {
     Shape side_nub =
         Hull(Cube(kWallWidth, 2.75, kSwitchThickness)
                  .Translate(kWallWidth / 2 + kSwitchWidth / 2 -.2, 0, kSwitchThickness / 2),
              Cylinder(2.75, 1, 30).RotateX(90).Translate(kSwitchWidth / 2, 0, 1));
-    shapes.push_back(side_nub);
-    shapes.push_back(side_nub.RotateZ(180));
+    shapes->push_back(side_nub);
+    shapes->push_back(side_nub.RotateZ(180));
   }
   if (add_top_nub) {
     double height = .9;
     Shape nub = Cube(3.8, .5, height)
                     .Translate(0, kSwitchWidth / 2 - .25, kSwitchThickness  - height / 2);
-    shapes.push_back(nub);
-    shapes.push_back(nub.RotateZ(180));
+    shapes->push_back(nub);
+    shapes->push_back(nub.RotateZ(180));
   }
+}
+
+Shape BuildSwitch(bool add_side_nub, bool add_top_nub) {
+  std::vector<Shape> shapes;
+  Shape top_wall = Cube(kSwitchWidth + kWallWidth * 2, kWallWidth, kSwitchThickness)
+                       .Translate(0, kWallWidth / 2 + kSwitchWidth / 2, kSwitchThickness / 2);
+
+  shapes.push_back(top_wall);
+  shapes.push_back(top_wall.RotateZ(90));
+  shapes.push_back(top_wall.RotateZ(180));
+  shapes.push_back(top_wall.RotateZ(270));
 
+  AddSwitchNubs(add_side_nub, add_top_nub, &shapes);
   return UnionAll(shapes).TranslateZ(kSwitchThickness * -1);
 }
 
-Shape MakeDsaCap() {
-  return MakeCap({
-      {kDsaHeight / 2, kDsaBottomSize},
-      {kDsaHeight / 2, kDsaHalfSize},
-      {0, kDsaTopSize},
-  });
+}  // namespace
+
+Shape MakeSwitch(bool add_side_nub, bool add_top_nub) {
+  // The switch variants only depend on constants so they are built and rendered once and every
+  // key places the same module.
+  static const Shape kSwitches[4] = {
+      Module("key_switch", BuildSwitch(false, false).Prerender()),
+      Module("key_switch_top_nub", BuildSwitch(false, true).Prerender()),
+      Module("key_switch_side_nub", BuildSwitch(true, false).Prerender()),
+      Module("key_switch_side_top_nub", BuildSwitch(true, true).Prerender()),
+  };
+  return kSwitches[(add_side_nub ? 2 : 0) + (add_top_nub ? 1 : 0)];
 }
 
-Shape MakeSaCap() {
-  return MakeCap({
-      {kSaHeight / 2, kDsaBottomSize},
-      {kSaHeight / 2, kSaHalfSize},
-      {0, kDsaTopSize},
-  });
+Shape MakeSwitchNubs(bool add_side_nub, bool add_top_nub) {
+  auto build = [](bool side, bool top) {
+    std::vector<Shape> shapes;
+    AddSwitchNubs(side, top, &shapes);
+    return UnionAll(shapes).TranslateZ(kSwitchThickness * -1).Prerender();
+  };
+  static const Shape kNubs[3] = {
+      Module("key_switch_top_nubs", build(false, true)),
+      Module("key_switch_side_nubs", build(true, false)),
+      Module("key_switch_side_top_nubs", build(true, true)),
+  };
+  int index = (add_side_nub ? 2 : 0) + (add_top_nub ? 1 : 0);
+  return index == 0 ? Shape() : kNubs[index - 1];
 }
 
-Shape MakeSaTallCap() {
-  return MakeCap({
-      {kSaTallHeight / 2, kDsaBottomSize},
-      {kSaTallHeight / 2, kSaHalfSize},
+CapLoftParams GetCapLoftParams(KeyType type, SaEdgeType edge_type) {
+  CapLoftParams params;
+  double height = 0;
+  double half_size = 0;
+  switch (type) {
+    case KeyType::DSA:
+      height = kDsaHeight;
+      half_size = kDsaHalfSize;
+      break;
+    case KeyType::SA:
+    case KeyType::SA_EDGE:
+      height = kSaHeight;
+      half_size = kSaHalfSize;
+      break;
+    case KeyType::SA_TALL_EDGE:
+      height = kSaTallHeight;
+      half_size = kSaHalfSize;
+      break;
+  }
+  params.sections = {
+      {-1 * height, kDsaBottomSize},
+      {-0.5 * height, half_size},
       {0, kDsaTopSize},
-  });
+  };
+  if (type == KeyType::SA_EDGE) {
+    params.edge_height = kSaEdgeHeight - kSaHeight;
+  } else if (type == KeyType::SA_TALL_EDGE) {
+    params.edge_height = kSaTallEdgeHeight - kSaTallHeight;
+  }
+  params.edge_type = edge_type;
+  return params;
 }
 
-Shape MakeSaEdgeCap(SaEdgeType edge_type) {
-  // Everything will be the same as the sa cap in terms of offsets. Will just visually add the edge.
-  Shape sa_cap = MakeSaCap();
+Mesh MakeCapMesh(const CapLoftParams& params) {
+  SCAD_TRACE_SCOPE("MakeCapMesh");
+  int n = params.dish_depth > 0 ? std::max(1, params.dish_resolution) : 1;
+  int ring_size = 4 * n;
+  const CapSection& top = params.sections.back();
+  double half_top = top.width / 2;
 
-  double edge_height = kSaEdgeHeight - kSaHeight;
-  Shape bar = Cube(kDsaTopSize, .01, .01);
-  double half_top = kDsaTopSize * .5;
+  // Height of the top surface. The edge raises one side of the top into a slope (the edge is built
+  // on the bottom and rotated into place at the end) and the dish is cut into it.
+  auto top_z = [&](double x, double y) {
+    double z = top.z + params.edge_height * (half_top - y) / (2 * half_top);
+    if (params.dish_depth > 0) {
+      double u = x / half_top;
+      double v = y / half_top;
+      double f = params.spherical_dish ? 1 - (u * u + v * v) / 2 : 1 - u * u;
+      z -= params.dish_depth * std::max(0.0, f);
+    }
+    return z;
+  };
+  // Point i of a ring with half width h, counter clockwise viewed from above starting at -h, -h.
+  auto ring_point = [&](int i, double h) {
+    int side = i / n;
+    double t = -1 + 2.0 * (i % n) / n;
+    switch (side) {
+      case 0:
+        return glm::dvec2(t * h, -h);
+      case 1:
+        return glm::dvec2(h, t * h);
+      case 2:
+        return glm::dvec2(-t * h, h);
+      default:
+        return glm::dvec2(-h, -t * h);
+    }
+  };
+
+  Mesh mesh;
+  std::vector<std::vector<int>> rings;
+  for (size_t s = 0; s < params.sections.size(); ++s) {
+    const CapSection& section = params.sections[s];
+    bool is_top = s + 1 == params.sections.size();
+    std::vector<int> ring;
+    for (int i = 0; i < ring_size; ++i) {
+      glm::dvec2 p = ring_point(i, section.width / 2);
+      double z = is_top ? top_z(p.x, p.y) : section.z;
+      ring.push_back(mesh.AddPoint(glm::vec3(p.x, p.y, z)));
+    }
+    rings.push_back(std::move(ring));
+  }
+
+  glm::vec3 center(0);
+  for (const glm::vec3& p : mesh.points) {
+    center += p;
+  }
+  center /= static_cast<float>(mesh.points.size());
+  // Adds the quad a, b, c, d (clockwise from outside) as two triangles, picking the diagonal which
+  // keeps the surface convex.
+  auto add_quad = [&](int a, int b, int c, int d) {
+    const auto& p = mesh.points;
+    glm::vec3 normal = glm::cross(p[c] - p[a], p[b] - p[a]);
+    bool d_above = glm::dot(p[d] - p[a], normal) > 0;
+    bool center_above = glm::dot(center - p[a], normal) > 0;
+    if (d_above == center_above) {
+      mesh.AddFace({a, b, c});
+      mesh.AddFace({a, c, d});
+    } else {
+      mesh.AddFace({a, b, d});
+      mesh.AddFace({b, c, d});
+    }
+  };
+
+  mesh.AddFace(rings.front());
+  for (size_t s = 0; s + 1 < rings.size(); ++s) {
+    const auto& lower = rings[s];
+    const auto& upper = rings[s + 1];
+    for (int i = 0; i < ring_size; ++i) {
+      int j = (i + 1) % ring_size;
+      add_quad(lower[i], upper[i], upper[j], lower[j]);
+    }
+  }
+
+  // The top is a grid sharing its boundary with the top ring.
+  const std::vector<int>& top_ring = rings.back();
+  auto grid_index = [&](int i, int j) {
+    if (j == 0) {
+      return top_ring[i % ring_size];
+    }
+    if (i == n) {
+      return top_ring[n + j];
+    }
+    if (j == n) {
+      return top_ring[2 * n + (n - i)];
+    }
+    if (i == 0) {
+      return top_ring[(3 * n + (n - j)) % ring_size];
+    }
+    return -1;
+  };
+  std::vector<int> grid((n + 1) * (n + 1));
+  for (int j = 0; j <= n; ++j) {
+    for (int i = 0; i <= n; ++i) {
+      int index = grid_index(i, j);
+      if (index < 0) {
+        double x = -half_top + 2 * half_top * i / n;
+        double y = -half_top + 2 * half_top * j / n;
+        index = mesh.AddPoint(glm::vec3(x, y, top_z(x, y)));
+      }
+      grid[j * (n + 1) + i] = index;
+    }
+  }
+  if (n == 1) {
+    add_quad(grid[0], grid[2], grid[3], grid[1]);
+  } else {
+    for (int j = 0; j < n; ++j) {
+      for (int i = 0; i < n; ++i) {
+        int a = grid[j * (n + 1) + i];
+        int b = grid[(j + 1) * (n + 1) + i];
+        int c = grid[(j + 1) * (n + 1) + i + 1];
+        int d = grid[j * (n + 1) + i + 1];
+        mesh.AddFace({a, b, c});
+        mesh.AddFace({a, c, d});
+      }
+    }
+  }
 
-  Shape bottom_edge = Union(Hull(sa_cap,
-                                 bar.TranslateY(-1 * half_top),
-                                 bar.TranslateY(-1 * half_top).TranslateZ(edge_height),
-                                 bar.TranslateY(half_top)));
-  return RotateCapEdge(bottom_edge, edge_type);
+  double rotation = 0;
+  switch (params.edge_type) {
+    case SaEdgeType::LEFT:
+      rotation = -90;
+      break;
+    case SaEdgeType::RIGHT:
+      rotation = 90;
+      break;
+    case SaEdgeType::TOP:
+      rotation = 180;
+      break;
+    case SaEdgeType::BOTTOM:
+      break;
+  }
+  if (params.edge_height > 0 && rotation != 0) {
+    glm::mat4 m = Transform::Rotation(0, 0, rotation).GetMatrix();
+    for (glm::vec3& p : mesh.points) {
+      p = glm::vec3(m * glm::vec4(p, 1));
+    }
+  }
+  return mesh;
 }
 
-Shape MakeSaTallEdgeCap(SaEdgeType edge_type) {
-  Shape sa_cap = MakeSaTallCap();
+namespace {
+
+Shape BuildCap(KeyType type, SaEdgeType edge_type = SaEdgeType::BOTTOM) {
+  return MakeCapMesh(GetCapLoftParams(type, edge_type)).ToShape().Prerender();
+}
+
+// The points of the lofted cap of each key and edge type in key space, built once like the cap
+// modules since the checks ask for them for every key.
+const std::vector<glm::vec3>& GetLocalCapPoints(KeyType type, SaEdgeType edge_type) {
+  const int kNumTypes = static_cast<int>(KeyType::SA_TALL_EDGE) + 1;
+  const int kNumEdgeTypes = static_cast<int>(SaEdgeType::BOTTOM) + 1;
+  static const std::vector<std::vector<glm::vec3>> kPoints = [] {
+    std::vector<std::vector<glm::vec3>> points;
+    for (int t = 0; t < kNumTypes; ++t) {
+      for (int e = 0; e < kNumEdgeTypes; ++e) {
+        CapLoftParams params =
+            GetCapLoftParams(static_cast<KeyType>(t), static_cast<SaEdgeType>(e));
+        points.push_back(MakeCapMesh(params).points);
+      }
+    }
+    return points;
+  }();
+  return kPoints[static_cast<int>(type) * kNumEdgeTypes + static_cast<int>(edge_type)];
+}
+
+}  // namespace
 
-  double edge_height = kSaTallEdgeHeight - kSaTallHeight;
-  Shape bar = Cube(kDsaTopSize, .01, .01);
-  double half_top = kDsaTopSize * .5;
+Shape MakeDsaCap() {
+  static const Shape kCap = Module("dsa_cap", BuildCap(KeyType::DSA));
+  return kCap;
+}
+
+Shape MakeSaCap() {
+  static const Shape kCap = Module("sa_cap", BuildCap(KeyType::SA));
+  return kCap;
+}
+
+Shape MakeSaEdgeCap(SaEdgeType edge_type) {
+  static const Shape kCaps[4] = {
+      Module("sa_edge_cap_left", BuildCap(KeyType::SA_EDGE, SaEdgeType::LEFT)),
+      Module("sa_edge_cap_right", BuildCap(KeyType::SA_EDGE, SaEdgeType::RIGHT)),
+      Module("sa_edge_cap_top", BuildCap(KeyType::SA_EDGE, SaEdgeType::TOP)),
+      Module("sa_edge_cap_bottom", BuildCap(KeyType::SA_EDGE, SaEdgeType::BOTTOM)),
+  };
+  return kCaps[static_cast<int>(edge_type)];
+}
 
-  Shape bottom_edge = Union(Hull(sa_cap,
-                                 bar.TranslateY(-1 * half_top),
-                                 bar.TranslateY(-1 * half_top).TranslateZ(edge_height),
-                                 bar.TranslateY(half_top)));
-  return RotateCapEdge(bottom_edge, edge_type);
+Shape MakeSaTallEdgeCap(SaEdgeType edge_type) {
+  static const Shape kCaps[4] = {
+      Module("sa_tall_edge_cap_left", BuildCap(KeyType::SA_TALL_EDGE, SaEdgeType::LEFT)),
+      Module("sa_tall_edge_cap_right", BuildCap(KeyType::SA_TALL_EDGE, SaEdgeType::RIGHT)),
+      Module("sa_tall_edge_cap_top", BuildCap(KeyType::SA_TALL_EDGE, SaEdgeType::TOP)),
+      Module("sa_tall_edge_cap_bottom", BuildCap(KeyType::SA_TALL_EDGE, SaEdgeType::BOTTOM)),
+  };
+  return kCaps[static_cast<int>(edge_type)];
 }
 
 Key& Key::SetPosition(double x, double y, double z) {
@@ -144,30 +459,151 @@ Key& Key::SetPosition(double x, double y, double z) {
 }
 
 Key& Key::SetParent(const Key& key) {
-  parent_transforms = key.GetTransforms();
+  parent_transforms = TransformList();
+  parent_transforms.Append(key.local_transforms);
+  parent_transforms.Append(key.parent_transforms);
+  parent_node = key.parent_node;
   return *this;
 }
 
 Key& Key::SetParent(const TransformList& transforms) {
   parent_transforms = transforms;
+  parent_node = nullptr;
   return *this;
 }
 
-TransformList Key::GetTransforms() const {
-  TransformList transforms;
-  transforms.Append(local_transforms);
-  transforms.Append(parent_transforms);
-  return transforms;
+Key& Key::SetParent(std::shared_ptr<const TransformNode> node) {
+  parent_transforms = TransformList();
+  parent_node = std::move(node);
+  return *this;
 }
 
-TransformList Key::GetSwitchTransforms() const {
-  double switch_z_offset = type == KeyType::DSA ? kDsaSwitchZOffset : kSaSwitchZOffset;
+template <typename Fn>
+auto Key::ReadCache(Fn fn) const {
+  std::lock_guard<std::mutex> lock(cache_.mutex);
+  return fn(UpdateCache());
+}
+
+template <typename Fn>
+auto Key::ReadCorners(double offset, Fn fn) const {
+  std::lock_guard<std::mutex> lock(cache_.mutex);
+  return fn(UpdateCornerCache(offset));
+}
+
+const Key::Cache& Key::UpdateCache() const {
+  Cache& c = cache_.cache;
+  uint64_t parent_node_version = parent_node ? parent_node->GetWorldVersion() : 0;
+  if (c.valid && c.local_transforms == local_transforms &&
+      c.parent_transforms == parent_transforms && c.parent_node == parent_node &&
+      c.parent_node_version == parent_node_version && c.extra_width_top == extra_width_top &&
+      c.extra_width_bottom == extra_width_bottom && c.extra_width_left == extra_width_left &&
+      c.extra_width_right == extra_width_right && c.extra_z == extra_z && c.type == type &&
+      c.disable_switch_z_offset == disable_switch_z_offset) {
+    return c;
+  }
+
+  c.local_transforms = local_transforms;
+  c.parent_transforms = parent_transforms;
+  c.parent_node = parent_node;
+  c.parent_node_version = parent_node_version;
+  c.extra_width_top = extra_width_top;
+  c.extra_width_bottom = extra_width_bottom;
+  c.extra_width_left = extra_width_left;
+  c.extra_width_right = extra_width_right;
+  c.extra_z = extra_z;
+  c.type = type;
+  c.disable_switch_z_offset = disable_switch_z_offset;
+
+  c.transforms = TransformList();
+  c.transforms.Append(local_transforms);
+  c.transforms.Append(parent_transforms);
+  if (parent_node) {
+    c.transforms.Append(parent_node->GetWorldTransforms());
+  }
+
+  double switch_z_offset = GetSwitchZOffset(type);
   if (disable_switch_z_offset) {
     switch_z_offset = 0;
   }
-  TransformList transforms;
-  transforms.AddTransform().z = -1 * switch_z_offset - extra_z;
-  return transforms.Append(GetTransforms());
+  c.matrix = c.transforms.GetMatrix();
+  c.switch_transforms = TransformList();
+  c.switch_transforms.AddTransform().z = -1 * switch_z_offset - extra_z;
+  c.switch_transforms.Append(c.transforms);
+  c.switch_matrix = c.switch_transforms.GetMatrix();
+  c.inverse_switch_matrix = c.switch_transforms.GetInverseMatrix();
+
+  c.internal_corners.clear();
+  for (const glm::vec3& corner : {glm::vec3(-1, 1, 0),
+                                  glm::vec3(1, 1, 0),
+                                  glm::vec3(1, -1, 0),
+                                  glm::vec3(-1, -1, 0)}) {
+    TransformList transforms;
+    transforms.AddTransform({corner.x * kSwitchHorizontalOffset,
+                             corner.y * kSwitchHorizontalOffset,
+                             0});
+    c.internal_corners.push_back(transforms.Append(c.switch_transforms));
+  }
+  c.corners.clear();
+  c.valid = true;
+  return c;
+}
+
+const Key::CornerCache& Key::UpdateCornerCache(double offset) const {
+  const Cache& c = UpdateCache();
+  for (const CornerCache& corners : c.corners) {
+    if (corners.offset == offset) {
+      return corners;
+    }
+  }
+
+  // Only a handful of offsets are used for any one key.
+  if (cache_.cache.corners.size() >= 8) {
+    cache_.cache.corners.clear();
+  }
+  CornerCache corners;
+  corners.offset = offset;
+  double left = -1 * (kSwitchHorizontalOffset + extra_width_left + offset);
+  double right = kSwitchHorizontalOffset + extra_width_right + offset;
+  double top = kSwitchHorizontalOffset + extra_width_top + offset;
+  double bottom = -1 * (kSwitchHorizontalOffset + extra_width_bottom + offset);
+  const glm::vec3 local_points[4] = {
+      {left, top, 0}, {right, top, 0}, {right, bottom, 0}, {left, bottom, 0}};
+  const glm::vec3 outer_offsets[4] = {
+      {-1 * (extra_width_left + offset), extra_width_top + offset, 0},
+      {extra_width_right + offset, extra_width_top + offset, 0},
+      {extra_width_right + offset, -1 * (extra_width_bottom + offset), 0},
+      {-1 * (extra_width_left + offset), -1 * (extra_width_bottom + offset), 0},
+  };
+  for (int i = 0; i < 4; ++i) {
+    TransformList transforms;
+    transforms.AddTransform(outer_offsets[i]);
+    corners.corners.push_back(transforms.Append(c.internal_corners[i]));
+    glm::vec4 point = c.switch_matrix * glm::vec4(local_points[i], 1);
+    corners.points[i] = glm::vec3(point.x, point.y, point.z);
+  }
+  cache_.cache.corners.push_back(std::move(corners));
+  return cache_.cache.corners.back();
+}
+
+TransformList Key::GetTransforms() const {
+  return ReadCache([](const Cache& c) { return c.transforms; });
+}
+
+TransformList Key::GetSwitchTransforms() const {
+  return ReadCache([](const Cache& c) { return c.switch_transforms; });
+}
+
+glm::mat4 Key::GetSwitchMatrix() const {
+  return ReadCache([](const Cache& c) { return c.switch_matrix; });
+}
+
+glm::mat4 Key::GetInverseSwitchMatrix() const {
+  return ReadCache([](const Cache& c) { return c.inverse_switch_matrix; });
+}
+
+glm::vec3 Key::WorldToLocal(const glm::vec3& point) const {
+  glm::vec4 local = GetInverseSwitchMatrix() * glm::vec4(point, 1);
+  return glm::vec3(local.x, local.y, local.z);
 }
 
 Shape Key::GetInverseSwitch() const {
@@ -187,6 +623,41 @@ Shape Key::GetInverseCap(double custom_vertical_length) const {
   return transforms.Apply(Cube(width, height, 30).TranslateZ(15));
 }
 
+std::vector<glm::vec3> Key::GetCapPoints() const {
+  // The hull of the cap's points bounds the cap, dish included, so the points are enough for the
+  // convex checks; with a dished top the hull is slightly larger than the cap.
+  const std::vector<glm::vec3>& local = GetLocalCapPoints(type, sa_edge_type);
+
+  glm::mat4 m = ReadCache([](const Cache& c) { return c.matrix; });
+  if (disable_switch_z_offset) {
+    m = m * Transform(0, 0, GetSwitchZOffset(type)).GetMatrix();
+  }
+  std::vector<glm::vec3> points;
+  points.reserve(local.size());
+  for (const glm::vec3& p : local) {
+    points.push_back(glm::vec3(m * glm::vec4(p, 1)));
+  }
+  return points;
+}
+
+std::vector<glm::vec3> Key::GetInverseCapPoints(double custom_vertical_length) const {
+  // Matches the cube made by GetInverseCap.
+  double width = kDsaBottomSize + .1;
+  double height = custom_vertical_length > 0 ? custom_vertical_length : width;
+  glm::mat4 m = GetSwitchMatrix();
+  std::vector<glm::vec3> points;
+  for (double z : {extra_z, extra_z + 30}) {
+    for (glm::vec3 corner : {glm::vec3(-1, -1, 0),
+                             glm::vec3(1, -1, 0),
+                             glm::vec3(1, 1, 0),
+                             glm::vec3(-1, 1, 0)}) {
+      glm::vec3 p(corner.x * width / 2, corner.y * height / 2, z);
+      points.push_back(glm::vec3(m * glm::vec4(p, 1)));
+    }
+  }
+  return points;
+}
+
 Shape Key::GetSwitch() const {
   std::vector<Shape> shapes;
   if (extra_z > 0) {
@@ -253,7 +724,7 @@ Shape Key::GetCap(bool fill_in_cap_path) const {
 
   if (disable_switch_z_offset) {
     // Need to move the cap up since the transforms are measured at the switch top.
-    double switch_z_offset = type == KeyType::DSA ? kDsaSwitchZOffset : kSaSwitchZOffset;
+    double switch_z_offset = GetSwitchZOffset(type);
     TransformList transforms;
     transforms.AddTransform().z = switch_z_offset;
     return transforms.Append(GetTransforms()).Apply(cap);
@@ -261,65 +732,70 @@ Shape Key::GetCap(bool fill_in_cap_path) const {
   return GetTransforms().Apply(cap);
 }
 
+TransformList Key::GetTopLeft(double offset) const {
+  return ReadCorners(offset, [](const CornerCache& c) { return c.corners[0]; });
+}
+
 TransformList Key::GetTopRight(double offset) const {
-  TransformList transforms;
-  transforms.AddTransform({extra_width_right + offset, extra_width_top + offset, 0});
-  return transforms.Append(GetTopRightInternal());
+  return ReadCorners(offset, [](const CornerCache& c) { return c.corners[1]; });
 }
 
-TransformList Key::GetTopRightInternal() const {
-  TransformList transforms;
-  transforms.AddTransform({kSwitchHorizontalOffset, kSwitchHorizontalOffset, 0});
-  return transforms.Append(GetSwitchTransforms());
+TransformList Key::GetBottomRight(double offset) const {
+  return ReadCorners(offset, [](const CornerCache& c) { return c.corners[2]; });
 }
 
-TransformList Key::GetTopLeft(double offset) const {
-  TransformList transforms;
-  transforms.AddTransform({-1 * (extra_width_left + offset), extra_width_top + offset, 0});
-  return transforms.Append(GetTopLeftInternal());
+TransformList Key::GetBottomLeft(double offset) const {
+  return ReadCorners(offset, [](const CornerCache& c) { return c.corners[3]; });
 }
 
 TransformList Key::GetTopLeftInternal() const {
-  TransformList transforms;
-  transforms.AddTransform({-1 * kSwitchHorizontalOffset, kSwitchHorizontalOffset, 0});
-  return transforms.Append(GetSwitchTransforms());
+  return ReadCache([](const Cache& c) { return c.internal_corners[0]; });
 }
 
-TransformList Key::GetBottomRight(double offset) const {
-  TransformList transforms;
-  transforms.AddTransform({extra_width_right + offset, -1 * (extra_width_bottom + offset), 0});
-  return transforms.Append(GetBottomRightInternal());
+TransformList Key::GetTopRightInternal() const {
+  return ReadCache([](const Cache& c) { return c.internal_corners[1]; });
 }
 
 TransformList Key::GetBottomRightInternal() const {
-  TransformList transforms;
-  transforms.AddTransform({kSwitchHorizontalOffset, -1 * kSwitchHorizontalOffset, 0});
-  return transforms.Append(GetSwitchTransforms());
-}
-
-TransformList Key::GetBottomLeft(double offset) const {
-  TransformList transforms;
-  transforms.AddTransform(
-      {-1 * (extra_width_left + offset), -1 * (extra_width_bottom + offset), 0});
-  return transforms.Append(GetBottomLeftInternal());
+  return ReadCache([](const Cache& c) { return c.internal_corners[2]; });
 }
 
 TransformList Key::GetBottomLeftInternal() const {
-  TransformList transforms;
-  transforms.AddTransform({-1 * kSwitchHorizontalOffset, -1 * kSwitchHorizontalOffset, 0});
-  return transforms.Append(GetSwitchTransforms());
+  return ReadCache([](const Cache& c) { return c.internal_corners[3]; });
 }
 
 TransformList Key::GetMiddle() const {
   return GetSwitchTransforms();
 }
 
+glm::vec3 Key::GetMiddlePoint() const {
+  glm::mat4 m = GetSwitchMatrix();
+  return glm::vec3(m[3].x, m[3].y, m[3].z);
+}
+
 std::vector<TransformList> Key::GetCorners(double offset) const {
-  return {GetTopLeft(offset), GetTopRight(offset), GetBottomRight(offset), GetBottomLeft(offset)};
+  return ReadCorners(offset, [](const CornerCache& c) { return c.corners; });
+}
+
+std::array<glm::vec3, 4> Key::GetCornerPoints(double offset, double z) const {
+  std::array<glm::vec3, 4> points =
+      ReadCorners(offset, [](const CornerCache& c) { return c.points; });
+  if (z != 0) {
+    glm::vec3 normal(GetSwitchMatrix()[2]);
+    for (glm::vec3& p : points) {
+      p += static_cast<float>(z) * normal;
+    }
+  }
+  return points;
 }
 
 Shape GetPostConnector(double width) {
-  return Cube(width, width, 3.5).TranslateZ(3.5 / -2.0);
+  static const Shape kDefaultConnector =
+      Cube(kPostWidth, kPostWidth, kPostHeight).TranslateZ(kPostHeight / -2.0).Prerender();
+  if (width == kPostWidth) {
+    return kDefaultConnector;
+  }
+  return Cube(width, width, kPostHeight).TranslateZ(kPostHeight / -2.0);
 }
 
 Shape ConnectVertical(const Key& top, const Key& bottom, Shape connector, double offset) {
@@ -354,6 +830,334 @@ Shape ConnectDiagonal(const Key& top_left,
                     top_left.GetBottomRight(offset).Apply(connector)));
 }
 
+Shape ConnectVerticalSlab(const Key& top, const Key& bottom, double offset) {
+  return MakeConnectorSlab({&top, BOTTOM_RIGHT},
+                           {&top, BOTTOM_LEFT},
+                           {&bottom, TOP_LEFT},
+                           {&bottom, TOP_RIGHT},
+                           offset);
+}
+
+Shape ConnectHorizontalSlab(const Key& left, const Key& right, double offset) {
+  return MakeConnectorSlab({&left, TOP_RIGHT},
+                           {&left, BOTTOM_RIGHT},
+                           {&right, BOTTOM_LEFT},
+                           {&right, TOP_LEFT},
+                           offset);
+}
+
+Shape ConnectDiagonalSlab(const Key& top_left,
+                          const Key& top_right,
+                          const Key& bottom_right,
+                          const Key& bottom_left,
+                          double offset) {
+  return MakeConnectorSlab({&top_left, BOTTOM_RIGHT},
+                           {&top_right, BOTTOM_LEFT},
+                           {&bottom_right, TOP_LEFT},
+                           {&bottom_left, TOP_RIGHT},
+                           offset);
+}
+
+KeyPoints GetKeyPoints(const std::vector<const Key*>& keys, double offset) {
+  KeyPoints points;
+  size_t n = keys.size();
+  points.keys = keys;
+  for (auto* v : {&points.top_left,
+                  &points.top_right,
+                  &points.bottom_right,
+                  &points.bottom_left,
+                  &points.middle,
+                  &points.normal}) {
+    v->resize(n);
+  }
+  for (size_t i = 0; i < n; ++i) {
+    const Key& key = *keys[i];
+    std::array<glm::vec3, 4> corners = key.GetCornerPoints(offset);
+    points.top_left[i] = corners[0];
+    points.top_right[i] = corners[1];
+    points.bottom_right[i] = corners[2];
+    points.bottom_left[i] = corners[3];
+    glm::mat4 m = key.GetSwitchMatrix();
+    points.middle[i] = glm::vec3(m[3]);
+    points.normal[i] = glm::vec3(m[2]);
+  }
+  return points;
+}
+
+KeyPoints KeyGrid::GetPoints(double offset) const {
+  std::vector<const Key*> present;
+  present.reserve(keys_.size());
+  for (Key* key : keys()) {
+    present.push_back(key);
+  }
+  return GetKeyPoints(present, offset);
+}
+
+KeyGrid::KeyGrid(const std::vector<std::vector<Key*>>& data) : num_rows_(data.size()) {
+  for (const auto& row : data) {
+    num_columns_ = std::max(num_columns_, row.size());
+  }
+  keys_.resize(num_rows_ * num_columns_, nullptr);
+  for (size_t r = 0; r < data.size(); ++r) {
+    std::copy(data[r].begin(), data[r].end(), keys_.begin() + r * num_columns_);
+  }
+}
+
+std::vector<std::vector<Key*>> KeyGrid::ToRows() const {
+  std::vector<std::vector<Key*>> rows;
+  for (size_t r = 0; r < num_rows_; ++r) {
+    rows.push_back(row(r));
+  }
+  return rows;
+}
+
+Mesh KeyGrid::GetWeb(double offset) const {
+  SCAD_TRACE_SCOPE("KeyGrid::GetWeb");
+  SlabBuilder builder;
+  std::map<std::pair<const Key*, int>, int> vertices;
+  auto vertex = [&](const Key* key, Corner corner) {
+    auto it = vertices.find({key, corner});
+    if (it != vertices.end()) {
+      return it->second;
+    }
+    int index = builder.AddVertex(key->GetCornerPoints(offset)[corner],
+                                  key->GetCornerPoints(offset, -kPostHeight)[corner]);
+    vertices[{key, corner}] = index;
+    return index;
+  };
+  auto add_quad = [&](CornerRef a, CornerRef b, CornerRef c, CornerRef d) {
+    int ia = vertex(a.key, a.corner);
+    int ic = vertex(c.key, c.corner);
+    builder.AddTriangle(ia, vertex(b.key, b.corner), ic);
+    builder.AddTriangle(ic, vertex(d.key, d.corner), ia);
+  };
+
+  for (int r = 0; r < (int)num_rows(); ++r) {
+    for (int c = 0; c < (int)num_columns(); ++c) {
+      Key* key = get_key(r, c);
+      if (!key) {
+        continue;
+      }
+      if (Key* right = get_key(r, c + 1)) {
+        add_quad({key, TOP_RIGHT}, {key, BOTTOM_RIGHT}, {right, BOTTOM_LEFT}, {right, TOP_LEFT});
+      }
+      if (Key* bottom = get_key(r + 1, c)) {
+        add_quad({key, BOTTOM_RIGHT}, {key, BOTTOM_LEFT}, {bottom, TOP_LEFT}, {bottom, TOP_RIGHT});
+      }
+    }
+  }
+
+  // Diagonals fill the gap where four keys meet, keyed by the key up and to the left of it.
+  for (int r = -1; r < (int)num_rows(); ++r) {
+    for (int c = -1; c < (int)num_columns(); ++c) {
+      std::vector<CornerRef> corners;
+      if (Key* key = get_key(r, c)) {
+        corners.push_back({key, BOTTOM_RIGHT});
+      }
+      if (Key* key = get_key(r, c + 1)) {
+        corners.push_back({key, BOTTOM_LEFT});
+      }
+      if (Key* key = get_key(r + 1, c + 1)) {
+        corners.push_back({key, TOP_LEFT});
+      }
+      if (Key* key = get_key(r + 1, c)) {
+        corners.push_back({key, TOP_RIGHT});
+      }
+      if (corners.size() == 4) {
+        add_quad(corners[0], corners[1], corners[2], corners[3]);
+      } else if (corners.size() == 3) {
+        builder.AddTriangle(vertex(corners[0].key, corners[0].corner),
+                            vertex(corners[1].key, corners[1].corner),
+                            vertex(corners[2].key, corners[2].corner));
+      }
+    }
+  }
+  return builder.Build();
+}
+
+Mesh KeyGrid::GetSkirt(const SkirtParams& params) const {
+  SCAD_TRACE_SCOPE("KeyGrid::GetSkirt");
+  // The top surface is the key tops plus the web, as polygons of (key, corner) vertices. Edges used
+  // by a single polygon are on the boundary.
+  std::map<std::pair<const Key*, int>, int> ids;
+  std::vector<CornerRef> refs;
+  auto id = [&](CornerRef ref) {
+    auto inserted = ids.insert({{ref.key, ref.corner}, static_cast<int>(refs.size())});
+    if (inserted.second) {
+      refs.push_back(ref);
+    }
+    return inserted.first->second;
+  };
+  std::map<std::pair<int, int>, int> edge_counts;
+  auto add_polygon = [&](const std::vector<CornerRef>& polygon) {
+    for (size_t i = 0; i < polygon.size(); ++i) {
+      int a = id(polygon[i]);
+      int b = id(polygon[(i + 1) % polygon.size()]);
+      ++edge_counts[std::minmax(a, b)];
+    }
+  };
+
+  for (int r = 0; r < (int)num_rows(); ++r) {
+    for (int c = 0; c < (int)num_columns(); ++c) {
+      Key* key = get_key(r, c);
+      if (!key) {
+        continue;
+      }
+      add_polygon({{key, TOP_LEFT}, {key, TOP_RIGHT}, {key, BOTTOM_RIGHT}, {key, BOTTOM_LEFT}});
+      if (Key* right = get_key(r, c + 1)) {
+        add_polygon(
+            {{key, TOP_RIGHT}, {key, BOTTOM_RIGHT}, {right, BOTTOM_LEFT}, {right, TOP_LEFT}});
+      }
+      if (Key* bottom = get_key(r + 1, c)) {
+        add_polygon(
+            {{key, BOTTOM_RIGHT}, {key, BOTTOM_LEFT}, {bottom, TOP_LEFT}, {bottom, TOP_RIGHT}});
+      }
+    }
+  }
+  // Same as the diagonals of GetWeb.
+  for (int r = -1; r < (int)num_rows(); ++r) {
+    for (int c = -1; c < (int)num_columns(); ++c) {
+      std::vector<CornerRef> corners;
+      if (Key* key = get_key(r, c)) {
+        corners.push_back({key, BOTTOM_RIGHT});
+      }
+      if (Key* key = get_key(r, c + 1)) {
+        corners.push_back({key, BOTTOM_LEFT});
+      }
+      if (Key* key = get_key(r + 1, c + 1)) {
+        corners.push_back({key, TOP_LEFT});
+      }
+      if (Key* key = get_key(r + 1, c)) {
+        corners.push_back({key, TOP_RIGHT});
+      }
+      if (corners.size() >= 3) {
+        add_polygon(corners);
+      }
+    }
+  }
+
+  std::vector<glm::vec3> tops;
+  std::vector<glm::vec3> bottoms;
+  for (const CornerRef& ref : refs) {
+    tops.push_back(ref.key->GetCornerPoints(params.offset)[ref.corner]);
+    bottoms.push_back(ref.key->GetCornerPoints(params.offset, -kPostHeight)[ref.corner]);
+  }
+
+  // Chain the boundary edges into loops and keep the one enclosing the most area.
+  std::multimap<int, int> boundary;
+  for (const auto& entry : edge_counts) {
+    if (entry.second == 1) {
+      boundary.insert({entry.first.first, entry.first.second});
+      boundary.insert({entry.first.second, entry.first.first});
+    }
+  }
+  auto take_edge = [&boundary](int from, int to) {
+    auto range = boundary.equal_range(from);
+    for (auto it = range.first; it != range.second; ++it) {
+      if (it->second == to) {
+        boundary.erase(it);
+        return;
+      }
+    }
+  };
+  std::vector<int> loop;
+  double loop_area = 0;
+  while (!boundary.empty()) {
+    int start = boundary.begin()->first;
+    std::vector<int> current = {start};
+    int at = start;
+    while (true) {
+      auto it = boundary.find(at);
+      if (it == boundary.end()) {
+        break;
+      }
+      int next = it->second;
+      boundary.erase(it);
+      take_edge(next, at);
+      if (next == start) {
+        break;
+      }
+      current.push_back(next);
+      at = next;
+    }
+    double area = 0;
+    for (size_t i = 0; i < current.size(); ++i) {
+      const glm::vec3& a = tops[current[i]];
+      const glm::vec3& b = tops[current[(i + 1) % current.size()]];
+      area += a.x * b.y - b.x * a.y;
+    }
+    area /= 2;
+    if (std::abs(area) > std::abs(loop_area)) {
+      loop = std::move(current);
+      loop_area = area;
+    }
+  }
+  if (loop_area < 0) {
+    std::reverse(loop.begin(), loop.end());
+  }
+  // Drop points which are on top of the previous one, they have no direction to push out in.
+  std::vector<int> points;
+  for (int index : loop) {
+    if (points.empty() || glm::distance(glm::vec2(tops[points.back()]), glm::vec2(tops[index])) >
+                              1e-4f) {
+      points.push_back(index);
+    }
+  }
+  while (points.size() > 1 &&
+         glm::distance(glm::vec2(tops[points.back()]), glm::vec2(tops[points.front()])) < 1e-4f) {
+    points.pop_back();
+  }
+  Mesh mesh;
+  int n = static_cast<int>(points.size());
+  if (n < 3) {
+    return mesh;
+  }
+
+  // Every point of the loop gets a cross section of the wall: the top of its post, the outside and
+  // inside of the wall on the floor and the bottom of the post moved in by the thickness. The loop
+  // is counter clockwise so the outward normal of an edge is to its right.
+  double draft = std::tan(glm::radians(params.draft_angle));
+  auto edge_normal = [&](int a, int b) {
+    glm::vec2 d = glm::normalize(glm::vec2(tops[b]) - glm::vec2(tops[a]));
+    return glm::vec2(d.y, -d.x);
+  };
+  for (int i = 0; i < n; ++i) {
+    int prev = points[(i + n - 1) % n];
+    int at = points[i];
+    int next = points[(i + 1) % n];
+    glm::vec2 n1 = edge_normal(prev, at);
+    glm::vec2 n2 = edge_normal(at, next);
+    glm::vec2 bisector = n1 + n2;
+    glm::vec2 normal = glm::length(bisector) < 1e-6f ? n1 : glm::normalize(bisector);
+    // Mitered so the wall keeps its thickness around corners, limited for very sharp ones.
+    normal /= std::max(glm::dot(normal, n1), 0.25f);
+
+    const glm::vec3& top = tops[at];
+    glm::vec2 outside =
+        glm::vec2(top) + normal * static_cast<float>(draft * (top.z - params.floor_z));
+    glm::vec2 inside = outside - normal * static_cast<float>(params.thickness);
+    mesh.AddPoint(top);
+    mesh.AddPoint(glm::vec3(outside, params.floor_z));
+    mesh.AddPoint(glm::vec3(inside, params.floor_z));
+    mesh.AddPoint(bottoms[at] - glm::vec3(normal * static_cast<float>(params.thickness), 0));
+  }
+  for (int i = 0; i < n; ++i) {
+    int a = 4 * i;
+    int b = 4 * ((i + 1) % n);
+    for (int k = 0; k < 4; ++k) {
+      int k2 = (k + 1) % 4;
+      mesh.AddFace({a + k, a + k2, b + k2});
+      mesh.AddFace({a + k, b + k2, b + k});
+    }
+  }
+  if (mesh.Volume() < 0) {
+    for (auto& face : mesh.faces) {
+      std::reverse(face.begin(), face.end());
+    }
+  }
+  return mesh;
+}
+
 Shape Tri(const TransformList& t1,
           const TransformList& t2,
           const TransformList& t3,
@@ -411,4 +1215,31 @@ Shape TriMesh(const std::vector<Shape>& shapes) {
   return UnionAll(result);
 }
 
+Shape TriHullSlab(const TransformList& t1,
+                  const TransformList& t2,
+                  const TransformList& t3,
+                  const TransformList& t4) {
+  return TriMeshSlab({t1, t2, t3, t4});
+}
+
+Shape TriFanSlab(const TransformList& center, const std::vector<TransformList>& transforms) {
+  std::vector<TransformList> points = {center};
+  std::vector<glm::ivec3> triangles;
+  for (size_t i = 0; i < transforms.size(); ++i) {
+    points.push_back(transforms[i]);
+    if (i > 0) {
+      triangles.push_back({0, static_cast<int>(i), static_cast<int>(i + 1)});
+    }
+  }
+  return MakePostSlab(points, triangles);
+}
+
+Shape TriMeshSlab(const std::vector<TransformList>& transforms) {
+  std::vector<glm::ivec3> triangles;
+  for (int i = 0; i + 2 < static_cast<int>(transforms.size()); ++i) {
+    triangles.push_back({i, i + 1, i + 2});
+  }
+  return MakePostSlab(transforms, triangles);
+}
+
 }  // namespace scad
@@ -1,10 +1,13 @@
 #pragma once
 
+#include <array>
 #include <functional>
 #include <glm/glm.hpp>
 #include <memory>
+#include <mutex>
 #include <string>
 
+#include "mesh.h"
 #include "scad.h"
 #include "transform.h"
 
@@ -43,6 +46,9 @@ enum class KeyType {
 // For SA edge variants. Which side of the key the edge should be rendered.
 enum class SaEdgeType { LEFT, RIGHT, TOP, BOTTOM };
 
+// The const getters may be called on one key from several threads at once; the transforms they
+// derive are cached under a mutex. Changing the fields while another thread reads the key is a
+// data race like for any other struct.
 struct Key {
  public:
   Key() {
@@ -60,6 +66,9 @@ struct Key {
 
   TransformList parent_transforms;
   TransformList local_transforms;
+  // Applied after parent_transforms. Unlike parent_transforms this is live: moving the node (or any
+  // of its ancestors) moves this key without having to set the parent again.
+  std::shared_ptr<const TransformNode> parent_node;
 
   // These add extra width to the switch and offset the locations of the corners (GetTopLeft etc).
   double extra_width_top = 0;
@@ -83,8 +92,12 @@ struct Key {
   }
 
   Key& SetPosition(double x, double y, double z);
+  // Places this key relative to another key. The other key's local and parent transforms are copied
+  // but its parent_node is shared, so keys that should move together (a column, a thumb cluster)
+  // should hang off a common TransformNode.
   Key& SetParent(const Key& key);
   Key& SetParent(const TransformList& transforms);
+  Key& SetParent(std::shared_ptr<const TransformNode> node);
 
   Transform& t() {
     return local_transforms.mutable_front();
@@ -97,6 +110,11 @@ struct Key {
   TransformList GetTransforms() const;
   TransformList GetSwitchTransforms() const;
 
+  // Maps a world point into the switch coordinates of this key (the space MakeSwitch is built in):
+  // the top of the switch plate is centered at the origin and the cap sits above it in +z. This
+  // lets a point be tested against the local switch or cap box without placing any geometry.
+  glm::vec3 WorldToLocal(const glm::vec3& point) const;
+
   Shape GetSwitch() const;
   Shape GetInverseSwitch() const;
   // Used to subtract and clear space in the key cap's path. Vertical length can be explicitly
@@ -104,6 +122,12 @@ struct Key {
   Shape GetInverseCap(double custom_vertical_length = -1) const;
   Shape GetCap(bool fill_in_cap_path = false) const;
 
+  // World space points whose convex hull contains the cap from GetCap (without the filled in path).
+  // It is the cap itself unless the top is dished.
+  std::vector<glm::vec3> GetCapPoints() const;
+  // World space corners of the box from GetInverseCap.
+  std::vector<glm::vec3> GetInverseCapPoints(double custom_vertical_length = -1) const;
+
   // This is the outermost conner of the switch. You can specify an offset to scale the point back
   // by the specified x,y amount towards the center of the switch. If you had a centered 2x2 post
   // and you wanted the corner to line up with outmost point of the switch, you could specify an
@@ -119,62 +143,320 @@ struct Key {
   // Corners clockwise starting at top left. Will have size 4.
   std::vector<TransformList> GetCorners(double offset = 0) const;
 
+  // The world positions of GetCorners(offset), in the same order, without building any transform
+  // lists. z moves the points along the switch normal, e.g. -3.5 gives the bottoms of the posts
+  // from GetPostConnector.
+  std::array<glm::vec3, 4> GetCornerPoints(double offset = 0, double z = 0) const;
+  glm::vec3 GetMiddlePoint() const;
+  // The single matrix equivalent to GetSwitchTransforms.
+  glm::mat4 GetSwitchMatrix() const;
+  // Its inverse, for mapping many points with what WorldToLocal does for one.
+  glm::mat4 GetInverseSwitchMatrix() const;
+
  private:
+  // Everything derived from the transforms and the switch settings. It is rebuilt whenever any of
+  // the inputs it was computed from differ from the current field values, so the public fields can
+  // still be edited directly.
+  struct CornerCache {
+    double offset = 0;
+    std::vector<TransformList> corners;
+    std::array<glm::vec3, 4> points;
+  };
+  struct Cache {
+    bool valid = false;
+
+    TransformList local_transforms;
+    TransformList parent_transforms;
+    std::shared_ptr<const TransformNode> parent_node;
+    uint64_t parent_node_version = 0;
+    double extra_width_top = 0;
+    double extra_width_bottom = 0;
+    double extra_width_left = 0;
+    double extra_width_right = 0;
+    double extra_z = 0;
+    KeyType type = KeyType::DSA;
+    bool disable_switch_z_offset = false;
+
+    TransformList transforms;
+    glm::mat4 matrix;
+    TransformList switch_transforms;
+    glm::mat4 switch_matrix;
+    glm::mat4 inverse_switch_matrix;
+    // Inner corners clockwise starting at top left.
+    std::vector<TransformList> internal_corners;
+    std::vector<CornerCache> corners;
+  };
+
+  // The cache is shared by const calls, so it is only read and rebuilt under its mutex through
+  // these, which call fn with the up to date cache and return its result.
+  template <typename Fn>
+  auto ReadCache(Fn fn) const;
+  template <typename Fn>
+  auto ReadCorners(double offset, Fn fn) const;
+  // Both need the cache mutex held.
+  const Cache& UpdateCache() const;
+  const CornerCache& UpdateCornerCache(double offset) const;
+
   // These are the inner corners of the switch plate.
   TransformList GetTopRightInternal() const;
   TransformList GetTopLeftInternal() const;
   TransformList GetBottomRightInternal() const;
   TransformList GetBottomLeftInternal() const;
+
+  // A copied key gets its own mutex and an empty cache, so copying never reads a cache another
+  // thread may be rebuilding.
+  struct LockedCache {
+    LockedCache() = default;
+    LockedCache(const LockedCache&) {
+    }
+    LockedCache& operator=(const LockedCache&) {
+      std::lock_guard<std::mutex> lock(mutex);
+      cache = Cache();
+      return *this;
+    }
+
+    std::mutex mutex;
+    Cache cache;
+  };
+  mutable LockedCache cache_;
 };
 
-struct KeyGrid {
-  explicit KeyGrid(std::vector<std::vector<Key*>> data) : data(std::move(data)) {
+// Resolved positions for a set of keys, one array per anchor with element i belonging to keys[i].
+// Filled in a single pass over the keys by GetKeyPoints or KeyGrid::GetPoints.
+struct KeyPoints {
+  std::vector<const Key*> keys;
+  // Corners as returned by Key::GetCornerPoints for the requested offset.
+  std::vector<glm::vec3> top_left;
+  std::vector<glm::vec3> top_right;
+  std::vector<glm::vec3> bottom_right;
+  std::vector<glm::vec3> bottom_left;
+  std::vector<glm::vec3> middle;
+  // Unit normal of the switch top, pointing towards the cap.
+  std::vector<glm::vec3> normal;
+
+  size_t size() const {
+    return keys.size();
+  }
+};
+
+KeyPoints GetKeyPoints(const std::vector<const Key*>& keys, double offset = 0);
+
+// A row or column of a KeyGrid. Missing keys are nullptr. This is a view into the grid so it does
+// not allocate and is invalidated if the grid is destroyed.
+class KeySlice {
+ public:
+  class Iterator {
+   public:
+    Iterator(Key* const* p, size_t stride) : p_(p), stride_(stride) {
+    }
+    Key* operator*() const {
+      return *p_;
+    }
+    Iterator& operator++() {
+      p_ += stride_;
+      return *this;
+    }
+    bool operator!=(const Iterator& other) const {
+      return p_ != other.p_;
+    }
+
+   private:
+    Key* const* p_;
+    size_t stride_;
+  };
+
+  KeySlice(Key* const* first, size_t size, size_t stride)
+      : first_(first), size_(size), stride_(stride) {
+  }
+
+  size_t size() const {
+    return size_;
   }
 
-  std::vector<Key*> column(int c) {
+  Key* operator[](size_t i) const {
+    return first_[i * stride_];
+  }
+
+  Iterator begin() const {
+    return Iterator(first_, stride_);
+  }
+
+  Iterator end() const {
+    return Iterator(first_ + size_ * stride_, stride_);
+  }
+
+  // For code written against the old KeyGrid which returned rows and columns as vectors.
+  operator std::vector<Key*>() const {
     std::vector<Key*> result;
-    for (auto& row : data) {
-      result.push_back(row[c]);
+    for (Key* key : *this) {
+      result.push_back(key);
     }
     return result;
   }
 
-  std::vector<Key*> row(int r) {
-    return data[r];
-  }
+ private:
+  Key* const* first_;
+  size_t size_;
+  size_t stride_;
+};
 
-  Key* get_key(int row, int column) {
-    if (row < 0 || row >= num_rows()) {
-      return nullptr;
+// Every key in a KeyGrid in row major order, skipping missing keys. Does not allocate.
+class PresentKeys {
+ public:
+  class Iterator {
+   public:
+    Iterator(Key* const* p, Key* const* end) : p_(p), end_(end) {
+      SkipMissing();
     }
-    auto& r = data[row];
-    if (column < 0 || column >= r.size()) {
-      return nullptr;
+    Key* operator*() const {
+      return *p_;
+    }
+    Iterator& operator++() {
+      ++p_;
+      SkipMissing();
+      return *this;
+    }
+    bool operator!=(const Iterator& other) const {
+      return p_ != other.p_;
+    }
+
+   private:
+    void SkipMissing() {
+      while (p_ != end_ && *p_ == nullptr) {
+        ++p_;
+      }
     }
-    return r[column];
+
+    Key* const* p_;
+    Key* const* end_;
+  };
+
+  PresentKeys(Key* const* first, Key* const* last) : first_(first), last_(last) {
+  }
+
+  Iterator begin() const {
+    return Iterator(first_, last_);
   }
 
-  std::vector<Key*> keys() {
+  Iterator end() const {
+    return Iterator(last_, last_);
+  }
+
+  // For code written against the old KeyGrid which returned the keys as a vector.
+  operator std::vector<Key*>() const {
     std::vector<Key*> result;
-    for (auto& row : data) {
-      for (Key* key : row) {
-        if (key) {
-          result.push_back(key);
-        }
-      }
+    for (Key* key : *this) {
+      result.push_back(key);
     }
     return result;
   }
 
-  size_t num_columns() {
-    return data[0].size();
+  // Counts the keys, linear in the size of the grid.
+  size_t size() const {
+    size_t count = 0;
+    for (Key* key : *this) {
+      (void)key;
+      ++count;
+    }
+    return count;
+  }
+
+ private:
+  Key* const* first_;
+  Key* const* last_;
+};
+
+struct SkirtParams {
+  // Passed to the corner getters, like the offset of KeyGrid::GetWeb.
+  double offset = 0;
+  // Horizontal thickness of the wall at the floor.
+  double thickness = 3;
+  // Degrees the outside of the wall leans out from vertical on its way down to the floor.
+  double draft_angle = 0;
+  double floor_z = 0;
+};
+
+// Keys laid out in rows and columns. The grid does not own the keys and missing positions are
+// nullptr. Keys are stored flat in row major order so walking rows, columns or neighbours never
+// allocates.
+struct KeyGrid {
+  KeyGrid() {
+  }
+
+  KeyGrid(size_t num_rows, size_t num_columns)
+      : num_rows_(num_rows), num_columns_(num_columns), keys_(num_rows * num_columns, nullptr) {
+  }
+
+  // Rows may have different lengths, short rows are padded with missing keys.
+  explicit KeyGrid(const std::vector<std::vector<Key*>>& data);
+
+  KeySlice column(int c) const {
+    return KeySlice(keys_.data() + c, num_rows_, num_columns_);
+  }
+
+  KeySlice row(int r) const {
+    return KeySlice(keys_.data() + r * num_columns_, num_columns_, 1);
+  }
+
+  Key* get_key(int row, int column) const {
+    if (row < 0 || row >= (int)num_rows() || column < 0 || column >= (int)num_columns()) {
+      return nullptr;
+    }
+    return keys_[row * num_columns_ + column];
+  }
+
+  void set_key(int row, int column, Key* key) {
+    keys_[row * num_columns_ + column] = key;
+  }
+
+  PresentKeys keys() const {
+    return PresentKeys(keys_.data(), keys_.data() + keys_.size());
   }
 
-  size_t num_rows() {
-    return data.size();
+  // The eight surrounding positions clockwise starting at the top left. Positions outside the grid
+  // or without a key are nullptr.
+  std::array<Key*, 8> neighbors(int row, int column) const {
+    return {get_key(row - 1, column - 1),
+            get_key(row - 1, column),
+            get_key(row - 1, column + 1),
+            get_key(row, column + 1),
+            get_key(row + 1, column + 1),
+            get_key(row + 1, column),
+            get_key(row + 1, column - 1),
+            get_key(row, column - 1)};
   }
 
-  std::vector<std::vector<Key*>> data;
+  size_t num_columns() const {
+    return num_columns_;
+  }
+
+  size_t num_rows() const {
+    return num_rows_;
+  }
+
+  // The whole connector web of the grid in one pass: every horizontal, vertical and diagonal
+  // connection between neighbouring keys (what ConnectHorizontal etc. make with the default post)
+  // welded into a single closed slab. Neighbouring connections share the corner vertices of their
+  // keys. Connections to a missing key are left out so its position stays open, and where one of
+  // the four keys around a diagonal is missing the remaining three corners are joined.
+  Mesh GetWeb(double offset = 0) const;
+
+  // A wall running around the outer boundary of the keys and their web down to the floor, as one
+  // closed mesh. The outside of the wall hangs from the outer edge of the boundary posts and the
+  // wall is the given thickness wide. Only the outer boundary loop gets a wall, holes left by
+  // missing keys in the middle of the grid do not.
+  Mesh GetSkirt(const SkirtParams& params = {}) const;
+
+  // The points of every present key in the same order as keys().
+  KeyPoints GetPoints(double offset = 0) const;
+
+  // A copy of the grid as rows, replacing the public data member the grid used to have.
+  std::vector<std::vector<Key*>> ToRows() const;
+
+ private:
+  size_t num_rows_ = 0;
+  size_t num_columns_ = 0;
+  std::vector<Key*> keys_;
 };
 
 // Used to connect key corners together. It is thin so it can have width issues when the two
@@ -197,6 +479,17 @@ Shape ConnectDiagonal(const Key& top_left,
                       Shape connector = GetPostConnector(),
                       double offset = 0);
 
+// The same solids as ConnectVertical, ConnectHorizontal and ConnectDiagonal with the default post
+// connector, computed directly from the corner points and written as a single polyhedron per
+// connection instead of two hulls of posts. These are much cheaper for OpenSCAD to render.
+Shape ConnectVerticalSlab(const Key& top, const Key& bottom, double offset = 0);
+Shape ConnectHorizontalSlab(const Key& left, const Key& right, double offset = 0);
+Shape ConnectDiagonalSlab(const Key& top_left,
+                          const Key& top_right,
+                          const Key& bottom_right,
+                          const Key& bottom_left,
+                          double offset = 0);
+
 Shape Tri(const TransformList& t1,
           const TransformList& t2,
           const TransformList& t3,
@@ -220,10 +513,50 @@ Shape TriFan(Shape center, const std::vector<Shape>& shapes);
 Shape TriMesh(const std::vector<TransformList>& transforms, Shape connector = GetPostConnector());
 Shape TriMesh(const std::vector<Shape>& shapes);
 
+// The same triangles as TriHull, TriFan and TriMesh with the default post connector, emitted as a
+// single welded slab polyhedron under the tops of the posts instead of a union of hulls. Triangles
+// standing close to parallel with their posts (vertical walls) would give a slab with no
+// thickness, so each of those is its own thin polyhedron spanning the tops and bottoms of its
+// posts, as thick as the posts lean out of the wall's plane. No hulls are emitted.
+Shape TriHullSlab(const TransformList& t1,
+                  const TransformList& t2,
+                  const TransformList& t3,
+                  const TransformList& t4);
+Shape TriFanSlab(const TransformList& center, const std::vector<TransformList>& transforms);
+Shape TriMeshSlab(const std::vector<TransformList>& transforms);
+
+// One cross section of a lofted key cap.
+struct CapSection {
+  double z;
+  double width;
+};
+
+struct CapLoftParams {
+  // Square cross sections from the bottom of the cap to the top. Caps made by the library have the
+  // top at z = 0.
+  std::vector<CapSection> sections;
+  // How far the center of the top is dished in. Spherical dishes are deepest in the middle,
+  // cylindrical ones run along y.
+  double dish_depth = 0;
+  bool spherical_dish = true;
+  // Number of subdivisions per side of the top used to shape the dish.
+  int dish_resolution = 8;
+  // Raises one edge of the top by this much, sloping down to the opposite edge (SA edge caps).
+  double edge_height = 0;
+  SaEdgeType edge_type = SaEdgeType::BOTTOM;
+};
+
+// The profile used for the caps of each key type.
+CapLoftParams GetCapLoftParams(KeyType type, SaEdgeType edge_type = SaEdgeType::BOTTOM);
+// Lofts between the sections into a single closed polyhedron.
+Mesh MakeCapMesh(const CapLoftParams& params);
+
 Shape MakeDsaCap();
 Shape MakeSaCap();
 Shape MakeSaEdgeCap(SaEdgeType edge_type = SaEdgeType::BOTTOM);
 Shape MakeSaTallEdgeCap(SaEdgeType edge_type = SaEdgeType::BOTTOM);
 Shape MakeSwitch(bool add_side_nub = true, bool add_top_nub = false);
+// Only the nubs of MakeSwitch, placed the same way. Empty without either nub.
+Shape MakeSwitchNubs(bool add_side_nub = true, bool add_top_nub = false);
 
 }  // namespace scad
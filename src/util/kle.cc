@@ -0,0 +1,488 @@
+#include "kle.h"
+
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "key.h"
+#include "trace.h"
+#include "transform.h"
+
+namespace scad {
+namespace {
+
+// Properties of one object in a row. Only the ones affecting placement are kept.
+struct KeyProperties {
+  bool has_x = false, has_y = false, has_w = false, has_h = false;
+  bool has_r = false, has_rx = false, has_ry = false;
+  double x = 0, y = 0, w = 0, h = 0, r = 0, rx = 0, ry = 0;
+};
+
+// Placement state carried from key to key, as in the editor.
+struct LayoutState {
+  double x = 0;
+  double y = 0;
+  double w = 1;
+  double h = 1;
+  double r = 0;
+  double rx = 0;
+  double ry = 0;
+};
+
+// A minimal JSON reader which walks the input in place. It only builds the strings it is asked
+// for and reuses one buffer for property names.
+class Parser {
+ public:
+  Parser(const char* begin, const char* end) : begin_(begin), p_(begin), end_(end) {
+  }
+
+  const std::string& error() const {
+    return error_;
+  }
+
+  long offset() const {
+    return static_cast<long>(p_ - begin_);
+  }
+
+  bool Fail(const char* message) {
+    if (error_.empty()) {
+      char buffer[128];
+      snprintf(buffer, sizeof(buffer), "%s at offset %ld", message, offset());
+      error_ = buffer;
+    }
+    return false;
+  }
+
+  // Returns the next non space character without consuming it, 0 at the end.
+  char Peek() {
+    while (p_ < end_ && (*p_ == ' ' || *p_ == '\n' || *p_ == '\r' || *p_ == '\t')) {
+      ++p_;
+    }
+    return p_ < end_ ? *p_ : 0;
+  }
+
+  bool Consume(char c) {
+    if (Peek() != c) {
+      return false;
+    }
+    ++p_;
+    return true;
+  }
+
+  bool Expect(char c) {
+    if (!Consume(c)) {
+      char message[32];
+      snprintf(message, sizeof(message), "expected '%c'", c);
+      return Fail(message);
+    }
+    return true;
+  }
+
+  // Numbers are read with from_chars, which unlike strtod does not depend on the locale.
+  bool ParseNumber(double* out) {
+    Peek();
+    const char* start = p_ < end_ && *p_ == '+' ? p_ + 1 : p_;
+    std::from_chars_result result = std::from_chars(start, end_, *out);
+    if (result.ec != std::errc() || result.ptr == start) {
+      return Fail("expected a number");
+    }
+    p_ = result.ptr;
+    return true;
+  }
+
+  // Reads a quoted string. With out null the string is skipped.
+  bool ParseString(std::string* out) {
+    if (out) {
+      out->clear();
+    }
+    char quote = Peek();
+    if (quote != '"' && quote != '\'') {
+      return Fail("expected a string");
+    }
+    ++p_;
+    while (p_ < end_ && *p_ != quote) {
+      char c = *p_++;
+      if (c == '\\' && p_ < end_) {
+        c = *p_++;
+        switch (c) {
+          case 'n':
+            c = '\n';
+            break;
+          case 't':
+            c = '\t';
+            break;
+          case 'r':
+            c = '\r';
+            break;
+          case 'b':
+          case 'f':
+            c = ' ';
+            break;
+          case 'u':
+            // Names are only used for debugging so non ascii characters are not decoded.
+            p_ = std::min(p_ + 4, end_);
+            c = '?';
+            break;
+          default:
+            break;
+        }
+      }
+      if (out) {
+        out->push_back(c);
+      }
+    }
+    if (p_ >= end_) {
+      return Fail("unterminated string");
+    }
+    ++p_;
+    return true;
+  }
+
+  // Property names may be quoted or bare as in the editor's raw data.
+  bool ParseName(std::string* out) {
+    char c = Peek();
+    if (c == '"' || c == '\'') {
+      return ParseString(out);
+    }
+    out->clear();
+    while (p_ < end_ && (isalnum(static_cast<unsigned char>(*p_)) || *p_ == '_')) {
+      out->push_back(*p_++);
+    }
+    if (out->empty()) {
+      return Fail("expected a property name");
+    }
+    return true;
+  }
+
+  bool SkipValue() {
+    char c = Peek();
+    if (c == '"' || c == '\'') {
+      return ParseString(nullptr);
+    }
+    if (c == '[' || c == '{') {
+      char close = c == '[' ? ']' : '}';
+      ++p_;
+      if (Consume(close)) {
+        return true;
+      }
+      do {
+        if (c == '{') {
+          if (!ParseName(&name_) || !Expect(':')) {
+            return false;
+          }
+        }
+        if (!SkipValue()) {
+          return false;
+        }
+      } while (Consume(','));
+      return Expect(close);
+    }
+    // Numbers and literals.
+    const char* start = p_;
+    while (p_ < end_ && (isalnum(static_cast<unsigned char>(*p_)) || *p_ == '-' || *p_ == '+' ||
+                         *p_ == '.')) {
+      ++p_;
+    }
+    if (p_ == start) {
+      return Fail("unexpected character");
+    }
+    return true;
+  }
+
+  bool ParseProperties(KeyProperties* properties) {
+    if (!Expect('{')) {
+      return false;
+    }
+    if (Consume('}')) {
+      return true;
+    }
+    do {
+      if (Peek() == '}') {
+        // Trailing comma.
+        break;
+      }
+      if (!ParseName(&name_) || !Expect(':')) {
+        return false;
+      }
+      double* value = nullptr;
+      bool* has = nullptr;
+      if (name_ == "x") {
+        value = &properties->x;
+        has = &properties->has_x;
+      } else if (name_ == "y") {
+        value = &properties->y;
+        has = &properties->has_y;
+      } else if (name_ == "w") {
+        value = &properties->w;
+        has = &properties->has_w;
+      } else if (name_ == "h") {
+        value = &properties->h;
+        has = &properties->has_h;
+      } else if (name_ == "r") {
+        value = &properties->r;
+        has = &properties->has_r;
+      } else if (name_ == "rx") {
+        value = &properties->rx;
+        has = &properties->has_rx;
+      } else if (name_ == "ry") {
+        value = &properties->ry;
+        has = &properties->has_ry;
+      }
+      if (value) {
+        if (!ParseNumber(value)) {
+          return false;
+        }
+        *has = true;
+      } else if (!SkipValue()) {
+        return false;
+      }
+    } while (Consume(','));
+    return Expect('}');
+  }
+
+ private:
+  const char* begin_;
+  const char* p_;
+  const char* end_;
+  std::string name_;
+  std::string error_;
+};
+
+// Applies an object of properties the way the editor's serializer does.
+void ApplyProperties(const KeyProperties& properties, LayoutState* state, LayoutState* cluster) {
+  if (properties.has_r) {
+    state->r = properties.r;
+  }
+  if (properties.has_rx) {
+    state->rx = cluster->x = properties.rx;
+    state->x = cluster->x;
+    state->y = cluster->y;
+  }
+  if (properties.has_ry) {
+    state->ry = cluster->y = properties.ry;
+    state->x = cluster->x;
+    state->y = cluster->y;
+  }
+  if (properties.has_x) {
+    state->x += properties.x;
+  }
+  if (properties.has_y) {
+    state->y += properties.y;
+  }
+  if (properties.has_w) {
+    state->w = properties.w;
+  }
+  if (properties.has_h) {
+    state->h = properties.h;
+  }
+}
+
+Key MakeKleKey(const LayoutState& state, const KleParams& params) {
+  double u = params.unit;
+  double center_x = state.x + state.w / 2;
+  double center_y = state.y + state.h / 2;
+
+  Key key;
+  key.type = params.key_type;
+  if (state.r == 0) {
+    key.SetPosition(center_x * u, -center_y * u, 0);
+  } else {
+    // Offset from the rotation origin, then rotate about the origin and move it into place. The
+    // editor's y axis points down so its clockwise rotation is negative here.
+    key.local_transforms.AddTransform(
+        Transform((center_x - state.rx) * u, -(center_y - state.ry) * u, 0));
+    Transform& rotation = key.local_transforms.AddTransform(Transform::Rotation(0, 0, -state.r));
+    rotation.x = state.rx * u;
+    rotation.y = -state.ry * u;
+  }
+  key.extra_width_left = key.extra_width_right = (state.w - 1) * u / 2;
+  key.extra_width_top = key.extra_width_bottom = (state.h - 1) * u / 2;
+  return key;
+}
+
+// Reads the rows of a layout. Strict JSON has every row inside an outer array, the editor's raw
+// data leaves it out. On failure error_offset is how far parsing got.
+bool ParseRows(const std::string& json,
+               bool bracketed,
+               const KleParams& params,
+               KleLayout* layout,
+               std::string* error,
+               long* error_offset) {
+  *layout = KleLayout();
+  layout->unit = params.unit;
+  Parser parser(json.data(), json.data() + json.size());
+  auto fail = [&]() {
+    *error = parser.error();
+    *error_offset = parser.offset();
+    return false;
+  };
+  if (bracketed && !parser.Expect('[')) {
+    return fail();
+  }
+
+  LayoutState state;
+  LayoutState cluster;
+  std::string label;
+  bool first = true;
+  do {
+    char c = parser.Peek();
+    if (c == ']' || c == 0) {
+      break;
+    }
+    if (c == '{') {
+      // Keyboard metadata, only allowed before the first row.
+      if (!first) {
+        parser.Fail("metadata after the first row");
+        return fail();
+      }
+      first = false;
+      if (!parser.SkipValue()) {
+        return fail();
+      }
+      continue;
+    }
+    first = false;
+    if (!parser.Expect('[')) {
+      return fail();
+    }
+    std::vector<int> row;
+    do {
+      c = parser.Peek();
+      if (c == ']') {
+        break;
+      }
+      if (c == '{') {
+        KeyProperties properties;
+        if (!parser.ParseProperties(&properties)) {
+          return fail();
+        }
+        ApplyProperties(properties, &state, &cluster);
+        continue;
+      }
+      if (!parser.ParseString(&label)) {
+        return fail();
+      }
+      Key key = MakeKleKey(state, params);
+      key.name = label.substr(0, label.find('\n'));
+      if (key.name.empty()) {
+        key.name = "r" + std::to_string(layout->rows.size()) + "c" + std::to_string(row.size());
+      }
+      row.push_back(static_cast<int>(layout->keys.size()));
+      layout->keys.push_back(std::move(key));
+      state.x += state.w;
+      state.w = state.h = 1;
+    } while (parser.Consume(','));
+    if (!parser.Expect(']')) {
+      return fail();
+    }
+    layout->rows.push_back(std::move(row));
+    state.y += 1;
+    state.x = state.rx;
+  } while (parser.Consume(','));
+
+  if (bracketed && !parser.Expect(']')) {
+    return fail();
+  }
+  if (parser.Peek() != 0) {
+    parser.Fail("unexpected trailing data");
+    return fail();
+  }
+  return true;
+}
+
+}  // namespace
+
+KeyGrid KleLayout::MakeGrid(std::vector<const Key*>* dropped_keys) {
+  SCAD_TRACE_SCOPE("KleLayout::MakeGrid");
+  // Columns are found from the key centers sorted by x: a new column starts at every center more
+  // than half a unit right of the first center of the column before it.
+  std::vector<double> centers;
+  centers.reserve(keys.size());
+  for (const Key& key : keys) {
+    centers.push_back(key.GetMiddlePoint().x);
+  }
+  std::vector<double> sorted = centers;
+  std::sort(sorted.begin(), sorted.end());
+  std::vector<double> column_starts;
+  for (double x : sorted) {
+    if (column_starts.empty() || x > column_starts.back() + unit / 2) {
+      column_starts.push_back(x);
+    }
+  }
+
+  KeyGrid grid(rows.size(), column_starts.size());
+  for (size_t r = 0; r < rows.size(); ++r) {
+    for (int index : rows[r]) {
+      auto start = std::upper_bound(column_starts.begin(), column_starts.end(), centers[index]);
+      int column = static_cast<int>(start - column_starts.begin()) - 1;
+      // Keys of one row closer than half a unit share a column, the later one moves to the nearest
+      // free column.
+      int num_columns = static_cast<int>(column_starts.size());
+      for (int distance = 0; distance < num_columns; ++distance) {
+        if (column + distance < num_columns && !grid.get_key(r, column + distance)) {
+          column += distance;
+          break;
+        }
+        if (column - distance >= 0 && !grid.get_key(r, column - distance)) {
+          column -= distance;
+          break;
+        }
+      }
+      if (!grid.get_key(r, column)) {
+        grid.set_key(r, column, &keys[index]);
+      } else if (dropped_keys) {
+        dropped_keys->push_back(&keys[index]);
+      }
+    }
+  }
+  return grid;
+}
+
+bool ParseKle(const std::string& json,
+              KleLayout* layout,
+              const KleParams& params,
+              std::string* error) {
+  SCAD_TRACE_SCOPE("ParseKle");
+  // A leading bracket can open the outer array or the first row of raw data, so both are tried.
+  // The error reported is from the attempt which got further.
+  std::string strict_error;
+  long strict_offset = 0;
+  if (ParseRows(json, true, params, layout, &strict_error, &strict_offset)) {
+    return true;
+  }
+  std::string raw_error;
+  long raw_offset = 0;
+  if (ParseRows(json, false, params, layout, &raw_error, &raw_offset)) {
+    return true;
+  }
+  if (error) {
+    *error = strict_offset >= raw_offset ? strict_error : raw_error;
+  }
+  return false;
+}
+
+bool ReadKleFile(const std::string& file_name,
+                 KleLayout* layout,
+                 const KleParams& params,
+                 std::string* error) {
+  FILE* file = fopen(file_name.c_str(), "rb");
+  if (!file) {
+    if (error) {
+      *error = "unable to open " + file_name;
+    }
+    return false;
+  }
+  std::string json;
+  char buffer[4096];
+  size_t read;
+  while ((read = fread(buffer, 1, sizeof(buffer), file)) > 0) {
+    json.append(buffer, read);
+  }
+  fclose(file);
+  return ParseKle(json, layout, params, error);
+}
+
+}  // namespace scad
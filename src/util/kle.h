@@ -0,0 +1,50 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "key.h"
+
+namespace scad {
+
+struct KleParams {
+  // Size of one layout unit in mm.
+  double unit = 19.05;
+  KeyType key_type = KeyType::DSA;
+};
+
+// A layout read from keyboard-layout-editor.com raw data or JSON.
+struct KleLayout {
+  std::vector<Key> keys;
+  // Indices into keys for every row of the layout, in file order.
+  std::vector<std::vector<int>> rows;
+
+  // KleParams::unit of the layout.
+  double unit = 19.05;
+
+  // A grid with one row per layout row. Columns follow the x positions of the keys rather than
+  // their order in the row, so the keys of a column staggered layout line up in columns. Row
+  // staggered layouts get the column whose keys are nearest. A row with more keys than there are
+  // columns, for instance keys stacked on top of each other, can not place them all; the keys left
+  // out are added to dropped_keys when it is given. The grid points into keys so keys must not be
+  // resized while it is in use.
+  KeyGrid MakeGrid(std::vector<const Key*>* dropped_keys = nullptr);
+};
+
+// Reads a layout from KLE JSON. Both strict JSON and the raw data format of the editor (unquoted
+// property names) are accepted. Key positions follow the editor: x, y, w and h in units, r is a
+// clockwise rotation in degrees about rx, ry. Keys are placed with their switch centered on the
+// key with +y up and the top left of the layout at the origin, w and h widen the switch holder
+// through extra_width_*. The second rectangle of stepped and ISO keys (x2, w2 etc) is ignored.
+// Returns false and fills in error if the input can not be parsed.
+bool ParseKle(const std::string& json,
+              KleLayout* layout,
+              const KleParams& params = {},
+              std::string* error = nullptr);
+
+bool ReadKleFile(const std::string& file_name,
+                 KleLayout* layout,
+                 const KleParams& params = {},
+                 std::string* error = nullptr);
+
+}  // namespace scad
@@ -0,0 +1,121 @@
+#include "mesh.h"
+
+#include <glm/glm.hpp>
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "scad.h"
+
+namespace scad {
+
+void Mesh::Append(const Mesh& other) {
+  int start = static_cast<int>(points.size());
+  points.insert(points.end(), other.points.begin(), other.points.end());
+  for (const auto& face : other.faces) {
+    std::vector<int> shifted;
+    shifted.reserve(face.size());
+    for (int i : face) {
+      shifted.push_back(i + start);
+    }
+    faces.push_back(std::move(shifted));
+  }
+}
+
+double Mesh::Volume() const {
+  double volume = 0;
+  for (const auto& face : faces) {
+    for (size_t i = 1; i + 1 < face.size(); ++i) {
+      glm::dvec3 a = points[face[0]];
+      glm::dvec3 b = points[face[i]];
+      glm::dvec3 c = points[face[i + 1]];
+      volume += glm::dot(a, glm::cross(b, c));
+    }
+  }
+  // Faces are clockwise from the outside so the signed volume comes out negative.
+  return volume / -6.0;
+}
+
+Shape Mesh::ToShape(int convexity) const {
+  std::vector<Point3d> scad_points;
+  scad_points.reserve(points.size());
+  for (const glm::vec3& p : points) {
+    scad_points.push_back({p.x, p.y, p.z});
+  }
+  return Polyhedron(scad_points, faces, convexity);
+}
+
+Mesh MakeBoxMesh(const glm::vec3& min, const glm::vec3& max, const glm::mat4& transform) {
+  Mesh mesh;
+  for (int i = 0; i < 8; ++i) {
+    glm::vec3 p(i & 1 ? max.x : min.x, i & 2 ? max.y : min.y, i & 4 ? max.z : min.z);
+    mesh.AddPoint(glm::vec3(transform * glm::vec4(p, 1)));
+  }
+  // Bit 0 is x, bit 1 is y and bit 2 is z.
+  mesh.faces = {
+      {0, 1, 3, 2},  // bottom
+      {4, 6, 7, 5},  // top
+      {0, 4, 5, 1},  // front
+      {2, 3, 7, 6},  // back
+      {0, 2, 6, 4},  // left
+      {1, 5, 7, 3},  // right
+  };
+  return mesh;
+}
+
+int SlabBuilder::AddVertex(const glm::vec3& top, const glm::vec3& bottom) {
+  tops_.push_back(top);
+  bottoms_.push_back(bottom);
+  return static_cast<int>(tops_.size()) - 1;
+}
+
+void SlabBuilder::AddTriangle(int a, int b, int c) {
+  triangles_.push_back({a, b, c});
+}
+
+Mesh SlabBuilder::Build() const {
+  Mesh mesh;
+  int n = static_cast<int>(tops_.size());
+  mesh.points.reserve(2 * n);
+  mesh.points.insert(mesh.points.end(), tops_.begin(), tops_.end());
+  mesh.points.insert(mesh.points.end(), bottoms_.begin(), bottoms_.end());
+
+  // Directed edges of the triangles once they are counter clockwise viewed from above, keyed by the
+  // undirected edge.
+  std::map<std::pair<int, int>, std::pair<int, int>> edges;
+  std::map<std::pair<int, int>, int> edge_counts;
+  for (glm::ivec3 t : triangles_) {
+    glm::vec3 up = (tops_[t.x] - bottoms_[t.x]) + (tops_[t.y] - bottoms_[t.y]) +
+                   (tops_[t.z] - bottoms_[t.z]);
+    glm::vec3 normal = glm::cross(tops_[t.y] - tops_[t.x], tops_[t.z] - tops_[t.x]);
+    if (glm::dot(normal, normal) < 1e-12f) {
+      // Collinear points enclose nothing.
+      continue;
+    }
+    if (glm::dot(normal, up) < 0) {
+      std::swap(t.y, t.z);
+    }
+    mesh.AddFace({t.x, t.z, t.y});
+    mesh.AddFace({n + t.x, n + t.y, n + t.z});
+    for (std::pair<int, int> edge : {std::make_pair(t.x, t.y),
+                                     std::make_pair(t.y, t.z),
+                                     std::make_pair(t.z, t.x)}) {
+      std::pair<int, int> key = std::minmax(edge.first, edge.second);
+      edges[key] = edge;
+      ++edge_counts[key];
+    }
+  }
+
+  for (const auto& entry : edge_counts) {
+    if (entry.second != 1) {
+      continue;
+    }
+    int u = edges[entry.first].first;
+    int v = edges[entry.first].second;
+    mesh.AddFace({u, v, n + v});
+    mesh.AddFace({u, n + v, n + u});
+  }
+  return mesh;
+}
+
+}  // namespace scad
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "scad.h"
+
+namespace scad {
+
+// A polyhedron built in process. It can be written as an OpenSCAD polyhedron with ToShape and is
+// also what the in process geometry checks operate on.
+struct Mesh {
+  std::vector<glm::vec3> points;
+  // Point indices for each face, ordered clockwise when viewed from outside (the OpenSCAD
+  // polyhedron convention).
+  std::vector<std::vector<int>> faces;
+
+  int AddPoint(const glm::vec3& p) {
+    points.push_back(p);
+    return static_cast<int>(points.size()) - 1;
+  }
+
+  void AddFace(std::vector<int> face) {
+    faces.push_back(std::move(face));
+  }
+
+  bool empty() const {
+    return faces.empty();
+  }
+
+  // Adds the other mesh's points and faces. The meshes are not welded together.
+  void Append(const Mesh& other);
+
+  // Enclosed volume. Only meaningful for closed meshes.
+  double Volume() const;
+
+  Shape ToShape(int convexity = 1) const;
+};
+
+// An axis aligned box from min to max placed by transform.
+Mesh MakeBoxMesh(const glm::vec3& min,
+                 const glm::vec3& max,
+                 const glm::mat4& transform = glm::mat4(1));
+
+// Builds a closed slab under a triangulated surface, which is the solid you get by hulling a thin
+// post under each triangle corner and unioning the hulls. Every vertex has a top point and a
+// bottom point (the bottom of the post). Triangles sharing an edge are welded so only the outer
+// boundary of the surface gets side walls.
+class SlabBuilder {
+ public:
+  int AddVertex(const glm::vec3& top, const glm::vec3& bottom);
+  // The winding of the triangle does not matter, it is fixed up using the top to bottom direction.
+  void AddTriangle(int a, int b, int c);
+
+  size_t num_vertices() const {
+    return tops_.size();
+  }
+
+  Mesh Build() const;
+
+ private:
+  std::vector<glm::vec3> tops_;
+  std::vector<glm::vec3> bottoms_;
+  std::vector<glm::ivec3> triangles_;
+};
+
+}  // namespace scad
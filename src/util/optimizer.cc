@@ -0,0 +1,341 @@
+#include "optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <map>
+#include <vector>
+
+#include "interference.h"
+#include "key.h"
+#include "parallel.h"
+#include "trace.h"
+#include "transform.h"
+
+namespace scad {
+namespace {
+
+double Transform::*const kFields[] = {
+    &Transform::x, &Transform::y, &Transform::z, &Transform::rx, &Transform::ry, &Transform::rz};
+
+// A key the optimizer needs, either for its reach cost or for the interference check.
+struct TrackedKey {
+  const Key* key;
+  // Index of the column moving this key, -1 if it stays put.
+  int column = -1;
+  // Key and cap points in the column frame before any adjustment, or in world space for keys
+  // which are not in a column.
+  glm::mat4 matrix;
+  std::vector<glm::vec3> cap_points;
+  // Middle of the top of the cap in the key's own frame.
+  glm::vec3 cap_top = glm::vec3(0);
+  bool check_interference = false;
+  // The target of this key, -1 for none.
+  int target = -1;
+
+  // Current world state.
+  ConvexVolume cap;
+  double cost = 0;
+};
+
+struct ColumnState {
+  // World matrix of the column frame without the adjustment.
+  glm::mat4 frame;
+  Transform adjustment;
+  Transform step;
+  std::vector<int> keys;
+  int interferences = 0;
+};
+
+struct Candidate {
+  int column;
+  Transform adjustment;
+  double cost = 0;
+  bool feasible = false;
+};
+
+bool BoundsOverlap(const ConvexVolume& a, const ConvexVolume& b) {
+  return glm::all(glm::lessThanEqual(a.min, b.max)) && glm::all(glm::lessThanEqual(b.min, a.max));
+}
+
+// m places the key, cap_top is in the key's frame.
+double ReachCost(const ReachTarget& target,
+                 const glm::mat4& m,
+                 const glm::vec3& cap_top,
+                 double angle_weight) {
+  glm::vec3 p(m * glm::vec4(cap_top, 1));
+  glm::vec3 normal = glm::normalize(glm::vec3(m[2]));
+  glm::vec3 to_knuckle = target.knuckle - p;
+  double distance = glm::length(to_knuckle);
+  double error = distance - target.reach;
+  double facing = distance > 0 ? 1 - glm::dot(normal, to_knuckle) / distance : 0;
+  return target.weight * (error * error + angle_weight * facing);
+}
+
+ConvexVolume Place(const glm::mat4& m, const std::vector<glm::vec3>& points) {
+  std::vector<glm::vec3> placed;
+  placed.reserve(points.size());
+  for (const glm::vec3& p : points) {
+    placed.push_back(glm::vec3(m * glm::vec4(p, 1)));
+  }
+  return ConvexVolume(std::move(placed));
+}
+
+class Optimizer {
+ public:
+  explicit Optimizer(const OptimizerParams& params) : params_(params) {
+    for (const OptimizerColumn& column : params.columns) {
+      ColumnState state;
+      state.frame = column.node->GetWorldTransforms().GetMatrix();
+      state.step = column.step;
+      columns_.push_back(state);
+    }
+    for (const Key* key : params.keys) {
+      keys_[Track(key)].check_interference = true;
+    }
+    for (size_t i = 0; i < params.targets.size(); ++i) {
+      keys_[Track(params.targets[i].key)].target = static_cast<int>(i);
+    }
+    for (size_t i = 0; i < keys_.size(); ++i) {
+      TrackedKey& tracked = keys_[i];
+      if (tracked.column >= 0) {
+        columns_[tracked.column].keys.push_back(static_cast<int>(i));
+      }
+      glm::mat4 frame = tracked.column >= 0 ? columns_[tracked.column].frame : glm::mat4(1);
+      UpdateKey(&tracked, frame);
+    }
+    UpdateInterferences();
+  }
+
+  double cost() const {
+    double total = 0;
+    for (const TrackedKey& tracked : keys_) {
+      total += tracked.cost;
+    }
+    return total;
+  }
+
+  OptimizerResult Run() {
+    OptimizerResult result;
+    result.initial_cost = cost();
+    int refinements = 0;
+    while (result.iterations < params_.max_iterations && refinements < params_.max_refinements) {
+      SCAD_TRACE_SCOPE("Optimizer iteration");
+      ++result.iterations;
+      std::vector<Candidate> candidates = MakeCandidates();
+      result.evaluations += static_cast<int>(candidates.size());
+      ParallelFor(candidates.size(), params_.num_threads, "Optimizer worker", [&](size_t i) {
+        Evaluate(&candidates[i]);
+      });
+
+      double current = cost();
+      const Candidate* best = nullptr;
+      for (const Candidate& candidate : candidates) {
+        if (candidate.feasible && candidate.cost < current - 1e-9 &&
+            (!best || candidate.cost < best->cost)) {
+          best = &candidate;
+        }
+      }
+      if (!best) {
+        for (ColumnState& column : columns_) {
+          for (auto field : kFields) {
+            column.step.*field /= 2;
+          }
+        }
+        ++refinements;
+        continue;
+      }
+      Apply(*best);
+    }
+    result.cost = cost();
+
+    for (size_t c = 0; c < columns_.size(); ++c) {
+      const Transform& adjustment = columns_[c].adjustment;
+      result.adjustments.push_back(adjustment);
+      if (adjustment != Transform()) {
+        TransformList transforms = params_.columns[c].node->transforms();
+        transforms.AddTransformFront(adjustment);
+        params_.columns[c].node->SetTransforms(transforms);
+      }
+    }
+    return result;
+  }
+
+ private:
+  int Track(const Key* key) {
+    auto it = indices_.find(key);
+    if (it != indices_.end()) {
+      return it->second;
+    }
+    TrackedKey tracked;
+    tracked.key = key;
+    for (const TransformNode* node = key->parent_node.get(); node && tracked.column < 0;
+         node = node->parent().get()) {
+      for (size_t c = 0; c < params_.columns.size(); ++c) {
+        if (params_.columns[c].node.get() == node) {
+          tracked.column = static_cast<int>(c);
+        }
+      }
+    }
+    glm::mat4 to_frame =
+        tracked.column >= 0 ? glm::inverse(columns_[tracked.column].frame) : glm::mat4(1);
+    glm::mat4 key_matrix = key->GetTransforms().GetMatrix();
+    glm::mat4 to_key = glm::inverse(key_matrix);
+    tracked.matrix = to_frame * key_matrix;
+    for (const glm::vec3& p : key->GetCapPoints()) {
+      tracked.cap_points.push_back(glm::vec3(to_frame * glm::vec4(p, 1)));
+      tracked.cap_top.z = std::max(tracked.cap_top.z, glm::vec3(to_key * glm::vec4(p, 1)).z);
+    }
+    int index = static_cast<int>(keys_.size());
+    keys_.push_back(std::move(tracked));
+    indices_[key] = index;
+    return index;
+  }
+
+  glm::mat4 Frame(const ColumnState& column, const Transform& adjustment) const {
+    return column.frame * adjustment.GetMatrix();
+  }
+
+  void UpdateKey(TrackedKey* tracked, const glm::mat4& frame) {
+    tracked->cap = Place(frame, tracked->cap_points);
+    tracked->cost = tracked->target >= 0 ? ReachCost(params_.targets[tracked->target],
+                                                     frame * tracked->matrix,
+                                                     tracked->cap_top,
+                                                     params_.angle_weight)
+                                         : 0;
+  }
+
+  // Interfering pairs between the column's keys at the given caps and the keys of other columns.
+  int CountInterferences(int column, const std::vector<const ConvexVolume*>& caps) const {
+    int count = 0;
+    const std::vector<int>& members = columns_[column].keys;
+    for (size_t m = 0; m < members.size(); ++m) {
+      if (!keys_[members[m]].check_interference) {
+        continue;
+      }
+      for (const TrackedKey& other : keys_) {
+        if (other.column == column || !other.check_interference) {
+          continue;
+        }
+        if (BoundsOverlap(*caps[m], other.cap) && Intersects(*caps[m], other.cap)) {
+          ++count;
+        }
+      }
+    }
+    return count;
+  }
+
+  void UpdateInterferences() {
+    for (size_t c = 0; c < columns_.size(); ++c) {
+      std::vector<const ConvexVolume*> caps;
+      for (int k : columns_[c].keys) {
+        caps.push_back(&keys_[k].cap);
+      }
+      columns_[c].interferences = CountInterferences(static_cast<int>(c), caps);
+    }
+  }
+
+  std::vector<Candidate> MakeCandidates() const {
+    std::vector<Candidate> candidates;
+    for (size_t c = 0; c < columns_.size(); ++c) {
+      const ColumnState& column = columns_[c];
+      const Transform& limit = params_.columns[c].limit;
+      for (auto field : kFields) {
+        double step = column.step.*field;
+        if (step == 0) {
+          continue;
+        }
+        for (double direction : {-1.0, 1.0}) {
+          Candidate candidate;
+          candidate.column = static_cast<int>(c);
+          candidate.adjustment = column.adjustment;
+          candidate.adjustment.*field += direction * step;
+          double bound = limit.*field;
+          if (bound > 0 && std::abs(candidate.adjustment.*field) > bound) {
+            continue;
+          }
+          candidates.push_back(candidate);
+        }
+      }
+    }
+    return candidates;
+  }
+
+  // Only the keys of the candidate's column are placed again, the rest of the cost and the caps
+  // they are tested against come from the current layout.
+  void Evaluate(Candidate* candidate) const {
+    const ColumnState& column = columns_[candidate->column];
+    glm::mat4 frame = Frame(column, candidate->adjustment);
+    double total = cost();
+    std::vector<ConvexVolume> placed;
+    placed.reserve(column.keys.size());
+    for (int k : column.keys) {
+      const TrackedKey& tracked = keys_[k];
+      total -= tracked.cost;
+      if (tracked.target >= 0) {
+        total += ReachCost(params_.targets[tracked.target],
+                           frame * tracked.matrix,
+                           tracked.cap_top,
+                           params_.angle_weight);
+      }
+      placed.push_back(Place(frame, tracked.cap_points));
+    }
+    std::vector<const ConvexVolume*> caps;
+    for (const ConvexVolume& cap : placed) {
+      caps.push_back(&cap);
+    }
+    candidate->cost = total;
+    candidate->feasible = CountInterferences(candidate->column, caps) <= column.interferences;
+  }
+
+  void Apply(const Candidate& candidate) {
+    ColumnState& column = columns_[candidate.column];
+    column.adjustment = candidate.adjustment;
+    glm::mat4 frame = Frame(column, column.adjustment);
+    for (int k : column.keys) {
+      UpdateKey(&keys_[k], frame);
+    }
+    UpdateInterferences();
+  }
+
+  const OptimizerParams& params_;
+  std::vector<ColumnState> columns_;
+  std::vector<TrackedKey> keys_;
+  std::map<const Key*, int> indices_;
+};
+
+// Every column needs a node to move and every target and checked key must exist.
+bool CheckParams(const OptimizerParams& params) {
+  for (size_t c = 0; c < params.columns.size(); ++c) {
+    if (!params.columns[c].node) {
+      fprintf(stderr, "Optimizer column %zu has no node\n", c);
+      return false;
+    }
+  }
+  for (size_t t = 0; t < params.targets.size(); ++t) {
+    if (!params.targets[t].key) {
+      fprintf(stderr, "Optimizer target %zu has no key\n", t);
+      return false;
+    }
+  }
+  for (const Key* key : params.keys) {
+    if (!key) {
+      fprintf(stderr, "Optimizer keys include a null key\n");
+      return false;
+    }
+  }
+  return true;
+}
+
+}  // namespace
+
+OptimizerResult OptimizeLayout(const OptimizerParams& params) {
+  SCAD_TRACE_SCOPE("OptimizeLayout");
+  if (!CheckParams(params)) {
+    return OptimizerResult();
+  }
+  Optimizer optimizer(params);
+  return optimizer.Run();
+}
+
+}  // namespace scad
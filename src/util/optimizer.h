@@ -0,0 +1,69 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <memory>
+#include <vector>
+
+#include "key.h"
+#include "transform.h"
+
+namespace scad {
+
+// Where the finger pressing a key comes from. The key is comfortable when the top of its cap is
+// reach away from the knuckle and faces it.
+struct ReachTarget {
+  const Key* key = nullptr;
+  glm::vec3 knuckle = glm::vec3(0);
+  double reach = 70;
+  // How often the key is pressed, scales its cost.
+  double weight = 1;
+};
+
+// A group of keys moved together by the optimizer. Every key under node (directly or through
+// descendant nodes) moves with it, so the nodes of different columns must not be nested. The
+// adjustment is applied first, in the node's own frame, so rotations turn the column about the
+// node's origin.
+struct OptimizerColumn {
+  std::shared_ptr<TransformNode> node;
+  // First step tried for each field. Fields left at zero are not changed.
+  Transform step;
+  // Largest change allowed for each field in either direction, zero for no limit.
+  Transform limit;
+};
+
+struct OptimizerParams {
+  std::vector<OptimizerColumn> columns;
+  std::vector<ReachTarget> targets;
+  // Keys checked for cap interference, including the keys of the columns. Moves which make a
+  // column's caps interfere with more caps than before are rejected.
+  std::vector<const Key*> keys;
+  // Cost of a cap facing 90 degrees away from the knuckle, relative to a mm^2 of reach error.
+  double angle_weight = 100;
+  int max_iterations = 500;
+  // The steps are halved each time no candidate improves, and the search stops once they have been
+  // halved this many times in total. Steps never grow back, so the count is not reset by an
+  // improvement.
+  int max_refinements = 6;
+  // Zero uses one thread per hardware thread.
+  int num_threads = 0;
+};
+
+struct OptimizerResult {
+  double initial_cost = 0;
+  double cost = 0;
+  int iterations = 0;
+  // Number of candidate layouts evaluated.
+  int evaluations = 0;
+  // The change made to each column, in the order of OptimizerParams::columns.
+  std::vector<Transform> adjustments;
+};
+
+// Minimizes the reach cost of the targets by pattern search: every iteration tries stepping each
+// field of each column both ways, evaluating the candidates in parallel, and takes the best one.
+// When nothing improves the steps are halved. Only the keys of the moved column are re-evaluated
+// for a candidate, everything else comes from the cached current layout. The best adjustment is
+// written to each column's node as a transform at the front of its list. Returns an empty result,
+// after printing why, if a column has no node or a target or checked key is null.
+OptimizerResult OptimizeLayout(const OptimizerParams& params);
+
+}  // namespace scad
@@ -0,0 +1,96 @@
+#include "output_batch.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+
+#include "parallel.h"
+#include "trace.h"
+
+namespace scad {
+namespace {
+
+std::FILE* OpenFile(const std::string& file_name, const char* mode) {
+  std::FILE* file = nullptr;
+#ifdef _WIN32
+  fopen_s(&file, file_name.c_str(), mode);
+#else
+  file = std::fopen(file_name.c_str(), mode);
+#endif
+  if (file == nullptr) {
+    fprintf(stderr, "Could not open file %s\n", file_name.c_str());
+  }
+  return file;
+}
+
+// Copies the bytes of from to to, returning false after printing why if that failed.
+bool CopyFile(const std::string& from, const std::string& to) {
+  std::FILE* in = OpenFile(from, "rb");
+  if (in == nullptr) {
+    return false;
+  }
+  std::FILE* out = OpenFile(to, "wb");
+  if (out == nullptr) {
+    std::fclose(in);
+    return false;
+  }
+  char buffer[1 << 16];
+  bool written = true;
+  for (size_t size; (size = std::fread(buffer, 1, sizeof(buffer), in)) > 0;) {
+    written = written && std::fwrite(buffer, 1, size, out) == size;
+  }
+  bool read = !std::ferror(in);
+  std::fclose(in);
+  if (std::fclose(out) != 0 || !written || !read) {
+    fprintf(stderr, "Could not copy %s to %s\n", from.c_str(), to.c_str());
+    return false;
+  }
+  return true;
+}
+
+}  // namespace
+
+OutputBatch::OutputBatch(const OutputBatchParams& params) : params_(params) {
+}
+
+void OutputBatch::Add(const Shape& shape, const std::string& file_name) {
+  for (Job& job : jobs_) {
+    auto& names = job.file_names;
+    names.erase(std::remove(names.begin(), names.end(), file_name), names.end());
+  }
+  auto unused = [](const Job& job) { return job.file_names.empty(); };
+  jobs_.erase(std::remove_if(jobs_.begin(), jobs_.end(), unused), jobs_.end());
+  for (Job& job : jobs_) {
+    if (job.shape.node().id() == shape.node().id()) {
+      job.file_names.push_back(file_name);
+      return;
+    }
+  }
+  jobs_.push_back({shape, {file_name}});
+}
+
+bool OutputBatch::Write() {
+  SCAD_TRACE_SCOPE("OutputBatch::Write");
+  std::vector<Job> jobs;
+  jobs.swap(jobs_);
+
+  std::atomic<bool> ok(true);
+  ParallelFor(jobs.size(), params_.num_threads, "OutputBatch worker", [&](size_t i) {
+    const std::vector<std::string>& file_names = jobs[i].file_names;
+    SCAD_TRACE_SCOPE_DETAIL("OutputBatch job", file_names[0]);
+    // The shape is streamed to the first file that can be written, the later files are copies.
+    size_t written = 0;
+    while (written < file_names.size() && !jobs[i].shape.WriteToFile(file_names[written])) {
+      ok = false;
+      ++written;
+    }
+    for (size_t f = written + 1; f < file_names.size(); ++f) {
+      if (!CopyFile(file_names[written], file_names[f])) {
+        ok = false;
+      }
+    }
+  });
+  return ok;
+}
+
+}  // namespace scad
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include "scad.h"
+
+namespace scad {
+
+struct OutputBatchParams {
+  // Zero uses one thread per hardware thread.
+  int num_threads = 0;
+};
+
+// Writes several .scad files at once. Each file is rendered on its own thread, so writing a board's
+// outputs takes about as long as its largest file rather than the sum of them. Shapes are shared,
+// not copied, so jobs may use the same subtrees. Each shape is streamed straight to its file; a
+// shape added for several files is only rendered once, to the first, and the rest are copies.
+// Subtrees which are expensive to write and used by several files can be Prerender()ed before they
+// are added to have their text shared as well.
+class OutputBatch {
+ public:
+  explicit OutputBatch(const OutputBatchParams& params = OutputBatchParams());
+
+  // Adds shape to be written to file_name. A later shape for the same file replaces the earlier
+  // one, as with two WriteToFile calls.
+  void Add(const Shape& shape, const std::string& file_name);
+
+  // Writes every file added since the last call, returning false if any of them failed.
+  bool Write();
+
+ private:
+  struct Job {
+    Shape shape;
+    std::vector<std::string> file_names;
+  };
+
+  OutputBatchParams params_;
+  std::vector<Job> jobs_;
+};
+
+}  // namespace scad
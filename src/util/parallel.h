@@ -0,0 +1,43 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <vector>
+
+#include "trace.h"
+
+namespace scad {
+
+// Calls fn(i) for every i below count on up to num_threads threads, the calling thread included.
+// Zero uses one thread per hardware thread. Indices are handed out one at a time, so items of very
+// different cost still keep every thread busy. worker_name names each thread's trace scope and
+// must outlive the trace.
+template <typename Fn>
+void ParallelFor(size_t count,
+                 int num_threads,
+                 [[maybe_unused]] const char* worker_name,
+                 const Fn& fn) {
+  if (num_threads <= 0) {
+    num_threads = std::max(1u, std::thread::hardware_concurrency());
+  }
+  num_threads = std::min<int>(num_threads, std::max<size_t>(count, 1));
+  std::atomic<size_t> next(0);
+  auto work = [&]() {
+    SCAD_TRACE_SCOPE(worker_name);
+    for (size_t i = next++; i < count; i = next++) {
+      fn(i);
+    }
+  };
+  std::vector<std::thread> threads;
+  for (int i = 1; i < num_threads; ++i) {
+    threads.emplace_back(work);
+  }
+  work();
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
+
+}  // namespace scad
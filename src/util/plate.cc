@@ -0,0 +1,79 @@
+#include "plate.h"
+
+#include <algorithm>
+#include <cmath>
+#include <glm/glm.hpp>
+#include <vector>
+
+#include "key.h"
+#include "scad.h"
+#include "trace.h"
+
+namespace scad {
+namespace {
+
+const double kPlaneTolerance = 1e-4;
+
+// True if the key's switch is flat and its top is at height z.
+bool IsInPlane(const Key& key, double z) {
+  glm::mat4 m = key.GetSwitchMatrix();
+  return std::abs(m[2].z - 1) < kPlaneTolerance && std::abs(m[3].z - z) < kPlaneTolerance;
+}
+
+}  // namespace
+
+Shape MakeSwitchCutout(const Key& key) {
+  double h = kSwitchWidth / 2;
+  glm::mat4 m = key.GetSwitchMatrix();
+  std::vector<Point2d> points;
+  for (const glm::vec2& p :
+       {glm::vec2(-h, -h), glm::vec2(h, -h), glm::vec2(h, h), glm::vec2(-h, h)}) {
+    glm::vec4 world = m * glm::vec4(p.x, p.y, 0, 1);
+    points.push_back({world.x, world.y});
+  }
+  return Polygon(points);
+}
+
+Shape MakePlate(const std::vector<const Key*>& keys,
+                const PlateParams& params,
+                std::vector<const Key*>* off_plane_keys) {
+  SCAD_TRACE_SCOPE("MakePlate");
+  if (keys.empty()) {
+    return params.outline.LinearExtrude(params.thickness).TranslateZ(params.thickness / -2);
+  }
+  double z = keys[0]->GetSwitchMatrix()[3].z;
+
+  std::vector<Shape> cutouts;
+  std::vector<Shape> nubs;
+  std::vector<Shape> inverse_switches;
+  for (const Key* key : keys) {
+    if (!IsInPlane(*key, z)) {
+      if (off_plane_keys) {
+        off_plane_keys->push_back(key);
+      }
+      inverse_switches.push_back(key->GetInverseSwitch());
+      continue;
+    }
+    cutouts.push_back(MakeSwitchCutout(*key));
+    if (key->add_side_nub || key->add_top_nub) {
+      nubs.push_back(
+          key->GetSwitchTransforms().Apply(MakeSwitchNubs(key->add_side_nub, key->add_top_nub)));
+    }
+  }
+
+  // Extrusions are centered, so they are moved down by half the thickness.
+  Shape slab = params.outline.LinearExtrude(params.thickness).TranslateZ(z - params.thickness / 2);
+  Shape plate = params.outline.Subtract(UnionAll(cutouts))
+                    .LinearExtrude(params.thickness)
+                    .TranslateZ(z - params.thickness / 2);
+  if (!nubs.empty()) {
+    // The nubs reach back into the walls around their cutout, which may be past the outline.
+    plate = Union(plate, Intersection(slab, UnionAll(nubs)));
+  }
+  if (!inverse_switches.empty()) {
+    plate = plate.Subtract(UnionAll(inverse_switches));
+  }
+  return plate;
+}
+
+}  // namespace scad
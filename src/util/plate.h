@@ -0,0 +1,29 @@
+#pragma once
+
+#include <vector>
+
+#include "key.h"
+#include "scad.h"
+
+namespace scad {
+
+struct PlateParams {
+  // 2D outline of the plate. The top of the plate is placed at the height of the switch tops.
+  Shape outline;
+  double thickness = kSwitchThickness;
+};
+
+// The square cutout for a key's switch as a 2D polygon in the plane of the switch top.
+Shape MakeSwitchCutout(const Key& key);
+
+// Builds a flat plate for keys whose switches all lie in one horizontal plane. The square cutouts
+// are subtracted from the outline in 2D and the result is extruded once. The side and top nubs of
+// each key (MakeSwitchNubs, as set by add_side_nub and add_top_nub) are then added back as
+// solids, so the holes grip the switches exactly like the holes of Key::GetInverseSwitch. Keys
+// outside of the plane of the first key are cut out with Key::GetInverseSwitch and added to
+// off_plane_keys when it is given.
+Shape MakePlate(const std::vector<const Key*>& keys,
+                const PlateParams& params,
+                std::vector<const Key*>* off_plane_keys = nullptr);
+
+}  // namespace scad
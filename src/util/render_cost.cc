@@ -0,0 +1,222 @@
+#include "render_cost.h"
+
+#include <algorithm>
+#include <cmath>
+#include <unordered_map>
+#include <vector>
+
+#include "scad.h"
+#include "trace.h"
+
+namespace scad {
+namespace {
+
+using NodeView = Shape::NodeView;
+
+struct NodeCost {
+  size_t uses = 0;
+  int depth = 0;
+  int dimensions = 3;
+  double facets = 0;
+  // Facets going into the node's operation and the cost of the operation itself.
+  double input_facets = 0;
+  double cost = 0;
+  // Cost per facet of the operations above the node, summed over the places it is used.
+  double pressure = 0;
+};
+
+struct Ranked {
+  NodeView node;
+  double cost;
+};
+
+bool IsOperation(ShapeKind kind) {
+  switch (kind) {
+    case ShapeKind::UNION:
+    case ShapeKind::DIFFERENCE:
+    case ShapeKind::INTERSECTION:
+    case ShapeKind::HULL:
+    case ShapeKind::MINKOWSKI:
+      return true;
+    default:
+      return false;
+  }
+}
+
+class Estimator {
+ public:
+  explicit Estimator(const RenderCostParams& params) : params_(params) {
+  }
+
+  RenderCostEstimate Run(const Shape& shape) {
+    RenderCostEstimate estimate;
+    if (shape.node()) {
+      Visit(shape.node(), 1);
+    }
+    // Children come before their parents in order_, so walking it backwards reaches each node
+    // after every parent has added its pressure.
+    for (auto it = order_.rbegin(); it != order_.rend(); ++it) {
+      const NodeCost& cost = costs_[it->id()];
+      estimate.total_cost += cost.cost;
+      double pressure = cost.pressure + (cost.input_facets > 0 ? cost.cost / cost.input_facets : 0);
+      for (size_t i = 0; i < it->num_children(); ++i) {
+        if (NodeView child = it->child(i)) {
+          costs_[child.id()].pressure += pressure;
+        }
+      }
+    }
+
+    std::vector<Ranked> operations;
+    std::vector<Ranked> primitives;
+    for (NodeView node : order_) {
+      const NodeCost& cost = costs_[node.id()];
+      if (IsOperation(node.kind()) && cost.cost > 0) {
+        operations.push_back({node, cost.cost});
+      } else if (node.kind() == ShapeKind::PRIMITIVE && cost.pressure * cost.facets > 0) {
+        primitives.push_back({node, cost.pressure * cost.facets});
+      }
+    }
+    estimate.operations = MakeHotspots(operations);
+    estimate.primitives = MakeHotspots(primitives);
+    return estimate;
+  }
+
+ private:
+  const NodeCost& Visit(NodeView node, int depth) {
+    // References into an unordered_map stay valid as it grows.
+    NodeCost& cost = costs_[node.id()];
+    if (cost.uses++ > 0) {
+      return cost;
+    }
+    cost.depth = depth;
+    std::vector<double> inputs;
+    int child_dimensions = 0;
+    for (size_t i = 0; i < node.num_children(); ++i) {
+      if (NodeView child = node.child(i)) {
+        const NodeCost& child_cost = Visit(child, depth + 1);
+        inputs.push_back(child_cost.facets);
+        child_dimensions = child_dimensions == 0 ? child_cost.dimensions : child_dimensions;
+      }
+    }
+    cost.dimensions = node.dimensions() != 0 ? node.dimensions()
+                                             : (child_dimensions != 0 ? child_dimensions : 3);
+
+    double sum = 0;
+    for (double facets : inputs) {
+      sum += facets;
+    }
+    cost.facets = node.kind() == ShapeKind::PRIMITIVE ? node.num_facets() : sum;
+    switch (node.kind()) {
+      case ShapeKind::UNION:
+      case ShapeKind::DIFFERENCE:
+      case ShapeKind::INTERSECTION: {
+        double combined = 0;
+        for (size_t i = 0; i < inputs.size(); ++i) {
+          if (i > 0) {
+            cost.cost += params_.boolean_facet * (combined + inputs[i]);
+          }
+          combined += inputs[i];
+        }
+        break;
+      }
+      case ShapeKind::HULL:
+        cost.cost = params_.hull_facet * sum * std::log2(sum + 1);
+        break;
+      case ShapeKind::MINKOWSKI: {
+        double combined = inputs.empty() ? 0 : inputs[0];
+        for (size_t i = 1; i < inputs.size(); ++i) {
+          cost.cost += params_.minkowski_pair * combined * inputs[i];
+          combined += inputs[i];
+        }
+        break;
+      }
+      case ShapeKind::EXTRUDE:
+        // The edges of the 2D child become the sides, plus the two caps.
+        cost.facets = sum + 2;
+        break;
+      default:
+        break;
+    }
+    if (cost.cost > 0) {
+      cost.input_facets = sum;
+      if (cost.dimensions == 2) {
+        cost.cost *= params_.scale_2d;
+      }
+    }
+    order_.push_back(node);
+    return cost;
+  }
+
+  // The top_n by cost. Only these are labeled since a label may have to write a large primitive.
+  std::vector<RenderHotspot> MakeHotspots(std::vector<Ranked> ranked) {
+    std::stable_sort(ranked.begin(), ranked.end(), [](const Ranked& a, const Ranked& b) {
+      return a.cost > b.cost;
+    });
+    ranked.resize(std::min<size_t>(ranked.size(), std::max(params_.top_n, 0)));
+    std::vector<RenderHotspot> hotspots;
+    for (const Ranked& entry : ranked) {
+      const NodeCost& cost = costs_[entry.node.id()];
+      RenderHotspot hotspot;
+      hotspot.kind = entry.node.kind();
+      hotspot.label = entry.node.GetLabel();
+      hotspot.depth = cost.depth;
+      hotspot.uses = cost.uses;
+      hotspot.facets = cost.facets;
+      hotspot.cost = entry.cost;
+      hotspots.push_back(hotspot);
+    }
+    return hotspots;
+  }
+
+  const RenderCostParams& params_;
+  // Keyed by NodeView::id so shared subtrees are costed once.
+  std::unordered_map<const void*, NodeCost> costs_;
+  // Distinct nodes in post order.
+  std::vector<NodeView> order_;
+};
+
+}  // namespace
+
+RenderCostEstimate EstimateRenderCost(const Shape& shape, const RenderCostParams& params) {
+  SCAD_TRACE_SCOPE("EstimateRenderCost");
+  Estimator estimator(params);
+  return estimator.Run(shape);
+}
+
+void WriteRenderCostReport(const RenderCostEstimate& estimate, std::FILE* file) {
+  fprintf(file, "estimated render cost: %.0f\n", estimate.total_cost);
+  const struct {
+    const char* title;
+    const std::vector<RenderHotspot>& hotspots;
+  } sections[] = {{"operations", estimate.operations}, {"primitives", estimate.primitives}};
+  for (const auto& section : sections) {
+    if (section.hotspots.empty()) {
+      continue;
+    }
+    fprintf(file,
+            "\n%-10s %12s %6s %6s %6s %10s  %-13s %s\n",
+            section.title,
+            "cost",
+            "share",
+            "uses",
+            "depth",
+            "facets",
+            "kind",
+            "label");
+    for (const RenderHotspot& hotspot : section.hotspots) {
+      double share = estimate.total_cost > 0 ? 100 * hotspot.cost / estimate.total_cost : 0;
+      fprintf(file,
+              "%-10s %12.0f %5.1f%% %6zu %6d %10.0f  %-13s %s\n",
+              "",
+              hotspot.cost,
+              share,
+              hotspot.uses,
+              hotspot.depth,
+              hotspot.facets,
+              ShapeKindName(hotspot.kind),
+              hotspot.label.c_str());
+    }
+  }
+}
+
+}  // namespace scad
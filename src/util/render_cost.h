@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "scad.h"
+
+namespace scad {
+
+// Weights of the render cost model. Costs are in arbitrary units meant to grow with the time
+// OpenSCAD's CGAL backend spends on a subtree, so only their ratios mean anything.
+struct RenderCostParams {
+  // Per facet going into a 3D union, difference or intersection. Children are combined one at a
+  // time, so the facets of the earlier children are paid again for each later one.
+  double boolean_facet = 1;
+  // Per input facet times log2 of the input facets of a 3D hull.
+  double hull_facet = 0.05;
+  // Per pair of facets of the operands of a minkowski sum.
+  double minkowski_pair = 0.5;
+  // Scales the cost of 2D operations, which OpenSCAD does with a much faster polygon library.
+  double scale_2d = 0.02;
+  // Number of operations and primitives listed.
+  int top_n = 10;
+};
+
+struct RenderHotspot {
+  ShapeKind kind = ShapeKind::OTHER;
+  std::string label;
+  int depth = 0;
+  // Places the subtree is used. OpenSCAD caches the geometry of a subtree, so its operations are
+  // only paid for once.
+  size_t uses = 0;
+  // Estimated facets of the geometry made by the subtree.
+  double facets = 0;
+  double cost = 0;
+};
+
+struct RenderCostEstimate {
+  double total_cost = 0;
+  // Booleans, hulls and minkowski sums by the cost of the operation itself, without the cost of
+  // the operations below them.
+  std::vector<RenderHotspot> operations;
+  // Primitives by the part of the cost of the operations above them which comes from their
+  // facets. This is where high $fn spheres and cylinders show up.
+  std::vector<RenderHotspot> primitives;
+};
+
+// Estimates the render cost of shape from its tree without running OpenSCAD. Facets of every
+// subtree are estimated from the primitives ($fn and friends included) and each operation is
+// costed from the facets going into it.
+RenderCostEstimate EstimateRenderCost(const Shape& shape, const RenderCostParams& params = {});
+
+// Writes the total followed by the ranked operations and primitives.
+void WriteRenderCostReport(const RenderCostEstimate& estimate, std::FILE* file);
+
+}  // namespace scad
@@ -6,13 +6,260 @@
 #endif
 
 #include <math.h>
+#include <algorithm>
 #include <cstdio>
+#include <cstdlib>
+#include <map>
 #include <memory>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+#include "alloc_stats.h"
+#include "trace.h"
+
 namespace scad {
 
+// A node of the shape tree. Composites write write_name followed by their children in braces,
+// other nodes call writer.
+struct Shape::Node {
+  ShapeKind kind = ShapeKind::OTHER;
+  // Used by Stats reports, the first line written by the node when empty.
+  std::string label;
+  std::function<void(std::FILE*)> write_name;
+  ScadWriter writer;
+  // The shapes below this node. For nodes with a writer these are only used by Stats and
+  // EstimateRenderCost.
+  std::vector<Shape, AccountedAllocator<Shape, AllocationCategory::SHAPE_CHILDREN>> children;
+  size_t num_polyhedron_points = 0;
+  // Facets of a 3D primitive or edges of a 2D one as OpenSCAD would make them.
+  size_t num_facets = 0;
+  // 2 or 3 for nodes making 2D or 3D geometry, 0 when it depends on the children.
+  int dimensions = 0;
+
+  // label, or the first line written by the node shortened.
+  std::string GetLabel() const;
+};
+
+namespace {
+
+struct ModuleDefinition {
+  std::string name;
+  Shape body;
+};
+
+// Collects the modules used while writing a file so they can be defined once at the end.
+class ModuleContext {
+ public:
+  // Returns the name the module is defined under in this output.
+  const std::string& Use(const std::shared_ptr<const ModuleDefinition>& module) {
+    auto it = names_.find(module.get());
+    if (it != names_.end()) {
+      return it->second;
+    }
+    std::string name = module->name;
+    for (int i = 2; used_names_.count(name) > 0; ++i) {
+      name = module->name + "_" + std::to_string(i);
+    }
+    used_names_.insert({name, module.get()});
+    pending_.push_back(module);
+    return names_.insert({module.get(), name}).first->second;
+  }
+
+  // Writes every module used so far, including modules used by the bodies being written.
+  void WriteDefinitions(std::FILE* file) {
+    for (size_t i = 0; i < pending_.size(); ++i) {
+      std::shared_ptr<const ModuleDefinition> module = pending_[i];
+      fprintf(file, "\nmodule %s() {\n", names_[module.get()].c_str());
+      module->body.AppendScad(file, 1);
+      fprintf(file, "}\n");
+    }
+    pending_.clear();
+  }
+
+ private:
+  std::map<const ModuleDefinition*, std::string> names_;
+  std::map<std::string, const ModuleDefinition*> used_names_;
+  std::vector<std::shared_ptr<const ModuleDefinition>> pending_;
+};
+
+thread_local ModuleContext* current_module_context = nullptr;
+
+// Bytes written by each node while Shape::Stats measures a shape.
+using ByteCounts = std::unordered_map<const Shape::Node*, size_t>;
+thread_local ByteCounts* current_byte_counts = nullptr;
+
+// Writes shape followed by the definitions of the modules it uses.
+void WriteWithModules(const Shape& shape, std::FILE* file) {
+  ModuleContext* previous = current_module_context;
+  ModuleContext context;
+  current_module_context = &context;
+  shape.AppendScad(file, 0);
+  context.WriteDefinitions(file);
+  current_module_context = previous;
+}
+
+std::string RenderToString(const std::function<void(std::FILE*)>& writer) {
+  std::string result;
+#if defined(__unix__) || defined(__APPLE__)
+  char* buffer = nullptr;
+  size_t size = 0;
+  std::FILE* file = open_memstream(&buffer, &size);
+  if (file == nullptr) {
+    return result;
+  }
+  writer(file);
+  std::fclose(file);
+  result.assign(buffer, size);
+  free(buffer);
+#else
+  std::FILE* file = std::tmpfile();
+  if (file == nullptr) {
+    return result;
+  }
+  writer(file);
+  long size = std::ftell(file);
+  std::rewind(file);
+  result.resize(size > 0 ? size : 0);
+  result.resize(std::fread(&result[0], 1, result.size(), file));
+  std::fclose(file);
+#endif
+  return result;
+}
+
+// WriteComposite for any vector of shapes, node children may have another allocator.
+template <typename Shapes>
+void WriteShapes(std::FILE* file,
+                 const std::function<void(std::FILE*)>& write_name,
+                 const Shapes& shapes,
+                 int indent_level) {
+  WriteIndent(file, indent_level);
+  write_name(file);
+  fprintf(file, " {\n");
+  for (const Shape& s : shapes) {
+    s.AppendScad(file, indent_level + 1);
+  }
+  WriteIndent(file, indent_level);
+  fprintf(file, "}\n");
+}
+
+void WriteNode(const Shape::Node& node, std::FILE* file, int indent_level) {
+  if (node.write_name) {
+    WriteShapes(file, node.write_name, node.children, indent_level);
+  } else {
+    node.writer(file, indent_level);
+  }
+}
+
+// The writer is moved into the node's writer, so a primitive only makes one std::function.
+template <typename Writer>
+Shape::Node PrimitiveNode(Writer scad_writer) {
+  Shape::Node node;
+  node.kind = ShapeKind::PRIMITIVE;
+  SCAD_ALLOCATION_SCOPE(SHAPE_FUNCTION);
+  node.writer = [scad_writer = std::move(scad_writer)](std::FILE* file, int indent_level) {
+    WriteIndent(file, indent_level);
+    scad_writer(file);
+    fprintf(file, "\n");
+  };
+  return node;
+}
+
+// A composite of the single shape, which needs neither a copy of write_name nor a temporary
+// children vector.
+template <typename WriteName>
+Shape::Node WrapNode(const Shape& shape, WriteName write_name, ShapeKind kind = ShapeKind::OTHER) {
+  Shape::Node node;
+  node.kind = kind;
+  {
+    SCAD_ALLOCATION_SCOPE(SHAPE_FUNCTION);
+    node.write_name = std::move(write_name);
+  }
+  node.children = {shape};
+  return node;
+}
+
+// Segments OpenSCAD uses for a circle of radius r, as in its get_fragments_from_r.
+int GetFragments(double r,
+                 const Optional<double>& fn,
+                 const Optional<double>& fs,
+                 const Optional<double>& fa) {
+  if (fn.has_value() && fn.value() > 0) {
+    return std::max(3, static_cast<int>(fn.value()));
+  }
+  double min_size = fs.has_value() ? fs.value() : 2;
+  double min_angle = fa.has_value() ? fa.value() : 12;
+  return static_cast<int>(ceil(std::max(std::min(360 / min_angle, r * 2 * M_PI / min_size), 5.0)));
+}
+
+}  // namespace
+
+std::string Shape::Node::GetLabel() const {
+  const size_t kMaxLength = 60;
+  if (!label.empty()) {
+    return label;
+  }
+  std::string text = write_name ? RenderToString(write_name)
+                                : RenderToString([this](std::FILE* file) { writer(file, 0); });
+  text = text.substr(0, text.find('\n'));
+  if (text.size() > kMaxLength) {
+    text = text.substr(0, kMaxLength - 3) + "...";
+  }
+  return text;
+}
+
+ShapeKind Shape::NodeView::kind() const {
+  return node_->kind;
+}
+
+std::string Shape::NodeView::GetLabel() const {
+  return node_->GetLabel();
+}
+
+size_t Shape::NodeView::num_children() const {
+  return node_->children.size();
+}
+
+Shape::NodeView Shape::NodeView::child(size_t index) const {
+  return NodeView(node_->children[index].node_.get());
+}
+
+size_t Shape::NodeView::num_facets() const {
+  return node_->num_facets;
+}
+
+int Shape::NodeView::dimensions() const {
+  return node_->dimensions;
+}
+
+const char* ShapeKindName(ShapeKind kind) {
+  switch (kind) {
+    case ShapeKind::PRIMITIVE:
+      return "primitive";
+    case ShapeKind::TRANSFORM:
+      return "transform";
+    case ShapeKind::UNION:
+      return "union";
+    case ShapeKind::DIFFERENCE:
+      return "difference";
+    case ShapeKind::INTERSECTION:
+      return "intersection";
+    case ShapeKind::HULL:
+      return "hull";
+    case ShapeKind::MINKOWSKI:
+      return "minkowski";
+    case ShapeKind::EXTRUDE:
+      return "extrude";
+    case ShapeKind::MODULE:
+      return "module";
+    case ShapeKind::PRERENDERED:
+      return "prerendered";
+    case ShapeKind::OTHER:
+      return "other";
+  }
+  return "other";
+}
+
 const char* BoolStr(bool b) {
   return b ? "true" : "false";
 }
@@ -27,36 +274,49 @@ void WriteComposite(std::FILE* file,
                     const std::function<void(std::FILE*)>& write_name,
                     const std::vector<Shape>& shapes,
                     int indent_level) {
-  WriteIndent(file, indent_level);
-  write_name(file);
-  fprintf(file, " {\n");
-  for (const Shape& s : shapes) {
-    s.AppendScad(file, indent_level + 1);
-  }
-  WriteIndent(file, indent_level);
-  fprintf(file, "}\n");
+  WriteShapes(file, write_name, shapes, indent_level);
 }
 
 Shape Shape::Composite(const std::function<void(std::FILE*)>& write_name,
-                       const std::vector<Shape>& shapes) {
-  return Shape([=](std::FILE* file, int indent_level) {
-    WriteComposite(file, write_name, shapes, indent_level);
-  });
+                       const std::vector<Shape>& shapes,
+                       ShapeKind kind) {
+  Node node;
+  node.kind = kind;
+  {
+    SCAD_ALLOCATION_SCOPE(SHAPE_FUNCTION);
+    node.write_name = write_name;
+  }
+  node.children.assign(shapes.begin(), shapes.end());
+  return Shape(std::move(node));
 }
 
-Shape Shape::LiteralComposite(const std::string& name, const std::vector<Shape>& shapes) {
-  return Shape([=](std::FILE* file, int indent_level) {
-    WriteComposite(
-        file, [=](std::FILE*) { fprintf(file, "%s", name.c_str()); }, shapes, indent_level);
-  });
+Shape::Shape(const std::shared_ptr<ScadWriter>& scad) {
+  if (scad) {
+    *this = Shape(*scad);
+  }
+}
+
+Shape::Shape(ScadWriter scad) {
+  if (scad) {
+    Node node;
+    node.writer = std::move(scad);
+    *this = Shape(std::move(node));
+  }
+}
+
+Shape::Shape(Node node)
+    : node_(std::allocate_shared<const Node>(
+          AccountedAllocator<Node, AllocationCategory::SHAPE_NODE>(), std::move(node))) {
+}
+
+Shape Shape::LiteralComposite(const std::string& name,
+                              const std::vector<Shape>& shapes,
+                              ShapeKind kind) {
+  return Composite([=](std::FILE* file) { fprintf(file, "%s", name.c_str()); }, shapes, kind);
 }
 
 Shape Shape::Primitive(const std::function<void(std::FILE*)>& scad_writer) {
-  return Shape([=](std::FILE* file, int indent_level) {
-    WriteIndent(file, indent_level);
-    scad_writer(file);
-    fprintf(file, "\n");
-  });
+  return Shape(PrimitiveNode(scad_writer));
 }
 
 Shape Shape::LiteralPrimitive(const std::string& primitive) {
@@ -64,7 +324,7 @@ Shape Shape::LiteralPrimitive(const std::string& primitive) {
 }
 
 Shape Cube(const CubeParams& params) {
-  return Shape::Primitive([=](std::FILE* file) {
+  Shape::Node node = PrimitiveNode([=](std::FILE* file) {
     fprintf(file,
             "cube (size = [ %.3f, %.3f, %.3f], center = %s);",
             params.x,
@@ -72,6 +332,9 @@ Shape Cube(const CubeParams& params) {
             params.z,
             BoolStr(params.center));
   });
+  node.dimensions = 3;
+  node.num_facets = 6;
+  return Shape(std::move(node));
 }
 
 Shape Cube(double x, double y, double z, bool center) {
@@ -88,13 +351,16 @@ Shape Cube(double size, bool center) {
 }
 
 Shape Square(const SquareParams& params) {
-  return Shape::Primitive([=](std::FILE* file) {
+  Shape::Node node = PrimitiveNode([=](std::FILE* file) {
     fprintf(file,
             "square (size = [%.3f, %.3f], center = %s);",
             params.x,
             params.y,
             BoolStr(params.center));
   });
+  node.dimensions = 2;
+  node.num_facets = 4;
+  return Shape(std::move(node));
 }
 
 Shape Square(double x, double y, bool center) {
@@ -110,7 +376,7 @@ Shape Square(double size, bool center) {
 }
 
 Shape Sphere(const SphereParams& params) {
-  return Shape::Primitive([=](std::FILE* file) {
+  Shape::Node node = PrimitiveNode([=](std::FILE* file) {
     fprintf(file, "sphere (r = %.3f", params.r);
     if (params.fs.has_value()) {
       fprintf(file, ", $fs = %.3f", params.fs.value());
@@ -123,6 +389,11 @@ Shape Sphere(const SphereParams& params) {
     }
     fprintf(file, ");");
   });
+  // Rings of fragments quads plus the two caps.
+  int fragments = GetFragments(params.r, params.fn, params.fs, params.fa);
+  node.dimensions = 3;
+  node.num_facets = ((fragments + 1) / 2 - 1) * fragments + 2;
+  return Shape(std::move(node));
 }
 
 Shape Sphere(double radius) {
@@ -139,7 +410,7 @@ Shape Sphere(double radius, double fn) {
 }
 
 Shape Circle(const CircleParams& params) {
-  return Shape::Primitive([=](std::FILE* file) {
+  Shape::Node node = PrimitiveNode([=](std::FILE* file) {
     fprintf(file, "circle (r = %.3f", params.r);
     if (params.fs.has_value()) {
       fprintf(file, ", $fs = %.3f", params.fs.value());
@@ -152,6 +423,9 @@ Shape Circle(const CircleParams& params) {
     }
     fprintf(file, ");");
   });
+  node.dimensions = 2;
+  node.num_facets = GetFragments(params.r, params.fn, params.fs, params.fa);
+  return Shape(std::move(node));
 }
 
 Shape Circle(double radius) {
@@ -168,7 +442,7 @@ Shape Circle(double radius, double fn) {
 }
 
 Shape Cylinder(const CylinderParams& params) {
-  return Shape::Primitive([=](std::FILE* file) {
+  Shape::Node node = PrimitiveNode([=](std::FILE* file) {
     fprintf(file,
             "cylinder(h = %.3f, r1 = %.3f, r2 = %.3f, center = %s",
             params.h,
@@ -180,6 +454,9 @@ Shape Cylinder(const CylinderParams& params) {
     }
     fprintf(file, ");");
   });
+  node.dimensions = 3;
+  node.num_facets = GetFragments(std::max(params.r1, params.r2), params.fn, {}, {}) + 2;
+  return Shape(std::move(node));
 }
 
 Shape Cylinder(double height, double radius, Optional<double> fn) {
@@ -192,7 +469,9 @@ Shape Cylinder(double height, double radius, Optional<double> fn) {
 }
 
 Shape Polygon(const std::vector<Point2d>& points) {
-  return Shape::Primitive([=](std::FILE* file) {
+  // The points are copied into the writer.
+  SCAD_ALLOCATION_SCOPE(SHAPE_FUNCTION);
+  Shape::Node node = PrimitiveNode([=](std::FILE* file) {
     fprintf(file, "polygon (points = [");
     for (size_t i = 0; i < points.size(); ++i) {
       const Point2d& p = points[i];
@@ -203,6 +482,9 @@ Shape Polygon(const std::vector<Point2d>& points) {
     }
     fprintf(file, "]);");
   });
+  node.dimensions = 2;
+  node.num_facets = points.size();
+  return Shape(std::move(node));
 }
 
 Shape RegularPolygon(int n, double r) {
@@ -217,7 +499,8 @@ Shape RegularPolygon(int n, double r) {
 Shape Polyhedron(const std::vector<Point3d>& points,
                  const std::vector<std::vector<int>>& faces,
                  int convexity) {
-  return Shape::Primitive([=](std::FILE* file) {
+  SCAD_ALLOCATION_SCOPE(SHAPE_FUNCTION);
+  Shape::Node node = PrimitiveNode([=](std::FILE* file) {
     fprintf(file, "polyhedron (points = [");
     for (size_t i = 0; i < points.size(); ++i) {
       const Point3d& p = points[i];
@@ -243,29 +526,33 @@ Shape Polyhedron(const std::vector<Point3d>& points,
     }
     fprintf(file, "], convexity = %d);", convexity);
   });
+  node.num_polyhedron_points = points.size();
+  node.num_facets = faces.size();
+  node.dimensions = 3;
+  return Shape(std::move(node));
 }
 
 Shape HullAll(const std::vector<Shape>& shapes) {
-  return Shape::LiteralComposite("hull ()", shapes);
+  return Shape::LiteralComposite("hull ()", shapes, ShapeKind::HULL);
 }
 
 Shape UnionAll(const std::vector<Shape>& shapes) {
-  return Shape::LiteralComposite("union ()", shapes);
+  return Shape::LiteralComposite("union ()", shapes, ShapeKind::UNION);
 }
 
 Shape DifferenceAll(const std::vector<Shape>& shapes) {
-  return Shape::LiteralComposite("difference ()", shapes);
+  return Shape::LiteralComposite("difference ()", shapes, ShapeKind::DIFFERENCE);
 }
 
 Shape IntersectionAll(const std::vector<Shape>& shapes) {
-  return Shape::LiteralComposite("intersection ()", shapes);
+  return Shape::LiteralComposite("intersection ()", shapes, ShapeKind::INTERSECTION);
 }
 
 Shape Shape::Translate(double x, double y, double z) const {
   auto write_name = [=](std::FILE* file) {
     fprintf(file, "translate ([%.3f, %.3f, %.3f])", x, y, z);
   };
-  return Shape::Composite(write_name, {*this});
+  return Shape(WrapNode(*this, write_name, ShapeKind::TRANSFORM));
 }
 
 Shape Shape::TranslateX(double x) const {
@@ -282,21 +569,21 @@ Shape Shape::TranslateZ(double z) const {
 
 Shape Shape::Mirror(double x, double y, double z) const {
   auto write_name = [=](std::FILE* file) { fprintf(file, "mirror ([%.3f, %.3f, %.3f])", x, y, z); };
-  return Shape::Composite(write_name, {*this});
+  return Shape(WrapNode(*this, write_name, ShapeKind::TRANSFORM));
 }
 
 Shape Shape::Rotate(double rx, double ry, double rz) const {
   auto write_name = [=](std::FILE* file) {
     fprintf(file, "rotate ([%.3f, %.3f, %.3f])", rx, ry, rz);
   };
-  return Shape::Composite(write_name, {*this});
+  return Shape(WrapNode(*this, write_name, ShapeKind::TRANSFORM));
 }
 
 Shape Shape::Rotate(double degrees, double x, double y, double z) const {
   auto write_name = [=](std::FILE* file) {
     fprintf(file, "rotate (a = %.3f, v = [%.3f, %.3f, %.3f])", degrees, x, y, z);
   };
-  return Shape::Composite(write_name, {*this});
+  return Shape(WrapNode(*this, write_name, ShapeKind::TRANSFORM));
 }
 
 Shape Shape::RotateX(double degrees) const {
@@ -323,7 +610,9 @@ Shape Shape::LinearExtrude(const LinearExtrudeParams& params) const {
             params.slices,
             params.scale);
   };
-  return Shape::Composite(write_name, {*this});
+  Node node = WrapNode(*this, write_name, ShapeKind::EXTRUDE);
+  node.dimensions = 3;
+  return Shape(std::move(node));
 }
 
 Shape Shape::LinearExtrude(double height) const {
@@ -336,22 +625,22 @@ Shape Shape::Color(double r, double g, double b, double a) const {
   auto write_name = [=](std::FILE* file) {
     fprintf(file, "color (c = [%.3f, %.3f, %.3f, %.3f])", r, g, b, a);
   };
-  return Shape::Composite(write_name, {*this});
+  return Shape(WrapNode(*this, write_name));
 }
 
 Shape Shape::Color(const std::string& color, double a) const {
   auto write_name = [=](std::FILE* file) { fprintf(file, "color (\"%s\", %f)", color.c_str(), a); };
-  return Shape::Composite(write_name, {*this});
+  return Shape(WrapNode(*this, write_name));
 }
 
 Shape Shape::Alpha(double a) const {
   auto write_name = [=](std::FILE* file) { fprintf(file, "color (alpha = %.3f)", a); };
-  return Shape::Composite(write_name, {*this});
+  return Shape(WrapNode(*this, write_name));
 }
 
 Shape Shape::Scale(double x, double y, double z) const {
   auto write_name = [=](std::FILE* file) { fprintf(file, "scale ([%.3f, %.3f, %.3f])", x, y, z); };
-  return Shape::Composite(write_name, {*this});
+  return Shape(WrapNode(*this, write_name, ShapeKind::TRANSFORM));
 }
 
 Shape Shape::Scale(double s) const {
@@ -362,14 +651,14 @@ Shape Shape::OffsetRadius(double r, bool chamfer) const {
   auto write_name = [=](std::FILE* file) {
     fprintf(file, "offset (r = %.3f, chamfer = %s)", r, BoolStr(chamfer));
   };
-  return Shape::Composite(write_name, {*this});
+  return Shape(WrapNode(*this, write_name));
 }
 
 Shape Shape::OffsetDelta(double delta, bool chamfer) const {
   auto write_name = [=](std::FILE* file) {
     fprintf(file, "offset (delta = %.3f, chamfer = %s)", delta, BoolStr(chamfer));
   };
-  return Shape::Composite(write_name, {*this});
+  return Shape(WrapNode(*this, write_name));
 }
 
 Shape Shape::Subtract(const Shape& other) const {
@@ -400,26 +689,175 @@ Shape& Shape::operator+=(const Shape& other) {
 
 Shape Shape::Comment(const std::string& comment) const {
   Shape shape_copy = *this;
-  return Shape([=](std::FILE* file, int indent_level) {
-    WriteIndent(file, indent_level);
-    fprintf(file, "/* %s */\n", comment.c_str());
-    shape_copy.AppendScad(file, indent_level);
-  });
+  Node node;
+  {
+    SCAD_ALLOCATION_SCOPE(SHAPE_FUNCTION);
+    node.writer = [=](std::FILE* file, int indent_level) {
+      WriteIndent(file, indent_level);
+      fprintf(file, "/* %s */\n", comment.c_str());
+      shape_copy.AppendScad(file, indent_level);
+    };
+  }
+  node.children = {*this};
+  return Shape(std::move(node));
 }
 
 Shape Shape::Projection(bool cut) const {
   auto write_name = [=](std::FILE* file) { fprintf(file, "projection (cut = %s)", BoolStr(cut)); };
-  return Shape::Composite(write_name, {*this});
+  Node node = WrapNode(*this, write_name);
+  node.dimensions = 2;
+  return Shape(std::move(node));
+}
+
+Shape Shape::Prerender() const {
+  SCAD_TRACE_SCOPE("Shape::Prerender");
+  // Rendered at indent level 0 so each line only needs the caller's indent prepended. Modules are
+  // written inline since the text may end up in a file which never defines them.
+  ModuleContext* previous = current_module_context;
+  current_module_context = nullptr;
+  auto text = std::make_shared<const std::string>(
+      RenderToString([this](std::FILE* file) { AppendScad(file, 0); }));
+  current_module_context = previous;
+  Node node;
+  node.kind = ShapeKind::PRERENDERED;
+  SCAD_ALLOCATION_SCOPE(SHAPE_FUNCTION);
+  node.writer = [text](std::FILE* file, int indent_level) {
+    size_t start = 0;
+    while (start < text->size()) {
+      size_t end = text->find('\n', start);
+      end = end == std::string::npos ? text->size() : end + 1;
+      WriteIndent(file, indent_level);
+      std::fwrite(text->data() + start, 1, end - start, file);
+      start = end;
+    }
+  };
+  // Kept so Stats can see what the text is made of.
+  node.children = {*this};
+  return Shape(std::move(node));
+}
+
+ShapeStats Shape::Stats(int top_n, bool measure_bytes) const {
+  SCAD_TRACE_SCOPE("Shape::Stats");
+  ShapeStats stats;
+  struct Visit {
+    const Node* node;
+    int depth;
+  };
+  struct NodeInfo {
+    size_t uses = 0;
+    int depth = 0;
+  };
+  std::unordered_map<const Node*, NodeInfo> infos;
+  // Distinct nodes in the order they are first reached, so reports are stable.
+  std::vector<const Node*> nodes;
+  std::vector<Visit> stack;
+  if (node_) {
+    stack.push_back({node_.get(), 1});
+  }
+  while (!stack.empty()) {
+    Visit visit = stack.back();
+    stack.pop_back();
+    const Node& node = *visit.node;
+    NodeInfo& info = infos[visit.node];
+    if (info.uses++ == 0) {
+      nodes.push_back(visit.node);
+      info.depth = visit.depth;
+    }
+    ++stats.num_nodes;
+    ++stats.kind_counts[static_cast<int>(node.kind)];
+    stats.max_depth = std::max(stats.max_depth, visit.depth);
+    stats.num_polyhedron_points += node.num_polyhedron_points;
+    // A module body is written once however often the module is placed.
+    if (node.kind == ShapeKind::MODULE && info.uses > 1) {
+      continue;
+    }
+    for (auto it = node.children.rbegin(); it != node.children.rend(); ++it) {
+      if (it->node_) {
+        stack.push_back({it->node_.get(), visit.depth + 1});
+      }
+    }
+  }
+  stats.num_unique_subtrees = nodes.size();
+  for (const auto& entry : infos) {
+    if (entry.second.uses > 1) {
+      ++stats.num_shared_subtrees;
+    }
+  }
+
+  if (!measure_bytes) {
+    return stats;
+  }
+  ByteCounts bytes;
+  ByteCounts* previous = current_byte_counts;
+  current_byte_counts = &bytes;
+  stats.emitted_bytes = ToScad().size();
+  current_byte_counts = previous;
+
+  std::stable_sort(nodes.begin(), nodes.end(), [&](const Node* a, const Node* b) {
+    return bytes[a] > bytes[b];
+  });
+  nodes.resize(std::min<size_t>(nodes.size(), std::max(top_n, 0)));
+  for (const Node* node : nodes) {
+    ShapeStats::Subtree subtree;
+    subtree.kind = node->kind;
+    subtree.label = node->GetLabel();
+    subtree.depth = infos[node].depth;
+    subtree.uses = infos[node].uses;
+    subtree.num_polyhedron_points = node->num_polyhedron_points;
+    subtree.bytes = bytes[node];
+    stats.largest.push_back(subtree);
+  }
+  return stats;
+}
+
+void WriteStatsReport(const ShapeStats& stats, std::FILE* file) {
+  fprintf(file, "nodes: %zu, max depth %d\n", stats.num_nodes, stats.max_depth);
+  for (int i = 0; i < kNumShapeKinds; ++i) {
+    fprintf(file, "  %-13s %zu\n", ShapeKindName(static_cast<ShapeKind>(i)), stats.kind_counts[i]);
+  }
+  fprintf(file,
+          "subtrees: %zu unique, %zu shared\n",
+          stats.num_unique_subtrees,
+          stats.num_shared_subtrees);
+  fprintf(file, "polyhedron points: %zu\n", stats.num_polyhedron_points);
+  fprintf(file, "emitted bytes: %zu\n", stats.emitted_bytes);
+  if (stats.largest.empty()) {
+    return;
+  }
+  fprintf(file, "\n%10s %6s %6s %8s  %-13s %s\n", "bytes", "uses", "depth", "points", "kind",
+          "label");
+  for (const ShapeStats::Subtree& subtree : stats.largest) {
+    fprintf(file,
+            "%10zu %6zu %6d %8zu  %-13s %s\n",
+            subtree.bytes,
+            subtree.uses,
+            subtree.depth,
+            subtree.num_polyhedron_points,
+            ShapeKindName(subtree.kind),
+            subtree.label.c_str());
+  }
+}
+
+std::string Shape::ToScad() const {
+  SCAD_TRACE_SCOPE("Shape::ToScad");
+  return RenderToString([this](std::FILE* file) { WriteWithModules(*this, file); });
 }
 
 void Shape::AppendScad(std::FILE* file, int indent_level) const {
-  if (!scad_) {
+  if (!node_) {
     return;
   }
-  (*scad_)(file, indent_level);
+  if (current_byte_counts == nullptr) {
+    WriteNode(*node_, file, indent_level);
+    return;
+  }
+  long start = std::ftell(file);
+  WriteNode(*node_, file, indent_level);
+  (*current_byte_counts)[node_.get()] += std::ftell(file) - start;
 }
 
-void Shape::WriteToFile(const std::string& file_name) const {
+bool Shape::WriteToFile(const std::string& file_name) const {
+  SCAD_TRACE_SCOPE_DETAIL("Shape::WriteToFile", file_name);
   std::FILE* file = nullptr;
   bool opened = false;
 #ifdef _WIN32
@@ -431,10 +869,15 @@ void Shape::WriteToFile(const std::string& file_name) const {
 
   if (!opened || file == nullptr) {
     fprintf(stderr, "Could not open file %s\n", file_name.c_str());
-    return;
+    return false;
   }
-  AppendScad(file, 0);
-  std::fclose(file);
+  WriteWithModules(*this, file);
+  bool written = !std::ferror(file);
+  if (std::fclose(file) != 0 || !written) {
+    fprintf(stderr, "Could not write file %s\n", file_name.c_str());
+    return false;
+  }
+  return true;
 }
 
 Shape Import(const std::string& file_name, int convexity) {
@@ -448,7 +891,25 @@ Shape Import(const std::string& file_name, int convexity) {
 }
 
 Shape Minkowski(const Shape& first, const Shape& second) {
-  return Shape::LiteralComposite("minkowski ()", {first, second});
+  return Shape::LiteralComposite("minkowski ()", {first, second}, ShapeKind::MINKOWSKI);
+}
+
+Shape Module(const std::string& name, const Shape& body) {
+  SCAD_ALLOCATION_SCOPE(SHAPE_FUNCTION);
+  auto module = std::make_shared<const ModuleDefinition>(ModuleDefinition{name, body});
+  Shape::Node node;
+  node.kind = ShapeKind::MODULE;
+  node.label = name;
+  node.writer = [module](std::FILE* file, int indent_level) {
+    if (current_module_context == nullptr) {
+      module->body.AppendScad(file, indent_level);
+      return;
+    }
+    WriteIndent(file, indent_level);
+    fprintf(file, "%s();\n", current_module_context->Use(module).c_str());
+  };
+  node.children = {body};
+  return Shape(std::move(node));
 }
 
 }  // namespace scad
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <array>
+#include <cstdio>
 #include <functional>
 #include <memory>
 #include <string>
@@ -48,23 +50,116 @@ struct LinearExtrudeParams {
   bool center = true;
 };
 
+// What a node of a shape tree is, as reported by Shape::Stats.
+enum class ShapeKind {
+  PRIMITIVE,
+  TRANSFORM,
+  UNION,
+  DIFFERENCE,
+  INTERSECTION,
+  HULL,
+  MINKOWSKI,
+  EXTRUDE,
+  MODULE,
+  PRERENDERED,
+  OTHER,
+};
+const int kNumShapeKinds = static_cast<int>(ShapeKind::OTHER) + 1;
+const char* ShapeKindName(ShapeKind kind);
+
+struct ShapeStats {
+  // Nodes as they are written: a subtree placed in several places counts once per place, except
+  // for module bodies which are written once.
+  std::array<size_t, kNumShapeKinds> kind_counts = {};
+  size_t num_nodes = 0;
+  int max_depth = 0;
+  // Distinct subtrees, and how many of them are placed more than once.
+  size_t num_unique_subtrees = 0;
+  size_t num_shared_subtrees = 0;
+  // Points of every polyhedron written.
+  size_t num_polyhedron_points = 0;
+  size_t emitted_bytes = 0;
+
+  struct Subtree {
+    ShapeKind kind = ShapeKind::OTHER;
+    std::string label;
+    int depth = 0;
+    size_t uses = 0;
+    size_t num_polyhedron_points = 0;
+    // Bytes written for this subtree over all of its uses.
+    size_t bytes = 0;
+  };
+  // The subtrees writing the most bytes, largest first.
+  std::vector<Subtree> largest;
+};
+
 class Shape {
  public:
+  // A node of the shape tree, defined in scad.cc. Read it through NodeView.
+  struct Node;
+
+  // Read-only access to a node of the shape tree for analyses like EstimateRenderCost. Valid while
+  // a shape holding the node is alive.
+  class NodeView {
+   public:
+    NodeView() {
+    }
+
+    // False for the node of an empty shape.
+    explicit operator bool() const {
+      return node_ != nullptr;
+    }
+    // The same for every shape sharing the node.
+    const void* id() const {
+      return node_;
+    }
+
+    ShapeKind kind() const;
+    // The node's label, or the first line it writes shortened.
+    std::string GetLabel() const;
+    // The shapes below the node. For primitives and other nodes with their own writer these are
+    // only what Stats and EstimateRenderCost look at. Children may be empty.
+    size_t num_children() const;
+    NodeView child(size_t index) const;
+    // Facets of a 3D primitive or edges of a 2D one as OpenSCAD would make them.
+    size_t num_facets() const;
+    // 2 or 3 for nodes making 2D or 3D geometry, 0 when it depends on the children.
+    int dimensions() const;
+
+   private:
+    friend class Shape;
+
+    explicit NodeView(const Node* node) : node_(node) {
+    }
+
+    const Node* node_ = nullptr;
+  };
+
   Shape() {
   }
-  explicit Shape(std::shared_ptr<ScadWriter> scad) : scad_(std::move(scad)) {
-  }
-  explicit Shape(ScadWriter scad) : scad_(std::make_shared<ScadWriter>(std::move(scad))) {
+  // A null or empty writer makes an empty shape.
+  explicit Shape(const std::shared_ptr<ScadWriter>& scad);
+  explicit Shape(ScadWriter scad);
+  explicit Shape(Node node);
+
+  NodeView node() const {
+    return NodeView(node_.get());
   }
 
   static Shape Composite(const std::function<void(std::FILE*)>& write_name,
-                         const std::vector<Shape>& shapes);
-  static Shape LiteralComposite(const std::string& name, const std::vector<Shape>& shapes);
+                         const std::vector<Shape>& shapes,
+                         ShapeKind kind = ShapeKind::OTHER);
+  static Shape LiteralComposite(const std::string& name,
+                                const std::vector<Shape>& shapes,
+                                ShapeKind kind = ShapeKind::OTHER);
   static Shape Primitive(const std::function<void(std::FILE*)>& scad_writer);
   static Shape LiteralPrimitive(const std::string& primitive);
 
-  void WriteToFile(const std::string& file_name) const;
+  // Returns false, after printing why, if the file could not be opened or written.
+  bool WriteToFile(const std::string& file_name) const;
   void AppendScad(std::FILE* file, int indent_level) const;
+  // Returns the scad text for this shape as it would be written by WriteToFile.
+  std::string ToScad() const;
 
   Shape SCAD_WARN_UNUSED_RESULT Translate(double x, double y, double z) const;
   Shape SCAD_WARN_UNUSED_RESULT TranslateX(double x) const;
@@ -114,10 +209,23 @@ class Shape {
 
   Shape SCAD_WARN_UNUSED_RESULT Projection(bool cut = false) const;
 
+  // Renders the scad text for this shape once and returns a shape which writes the stored text
+  // (re-indented) instead of walking the shape tree again. Use this for shapes built only from
+  // constants which are placed many times, like the switch holder and key caps.
+  Shape SCAD_WARN_UNUSED_RESULT Prerender() const;
+
+  // Walks the tree and writes it once as ToScad would to measure it. The top_n subtrees writing
+  // the most bytes are listed in ShapeStats::largest. Without measure_bytes nothing is written, so
+  // emitted_bytes stays zero and largest empty, and only the counts from the walk are filled in.
+  ShapeStats Stats(int top_n = 10, bool measure_bytes = true) const;
+
  private:
-  std::shared_ptr<const ScadWriter> scad_;
+  std::shared_ptr<const Node> node_;
 };
 
+// Writes the counts of stats followed by a table of its largest subtrees.
+void WriteStatsReport(const ShapeStats& stats, std::FILE* file);
+
 struct CubeParams {
   double x = 1;
   double y = 1;
@@ -216,6 +324,13 @@ Shape SCAD_WARN_UNUSED_RESULT Import(const std::string& file_name, int convexity
 
 Shape SCAD_WARN_UNUSED_RESULT Minkowski(const Shape& first, const Shape& second);
 
+// Defines body as an OpenSCAD module and returns a shape which places it by name. Reuse the
+// returned shape (not the body) for every placement: WriteToFile and ToScad write each module used
+// once at the end of the output, so N placements cost N one line calls instead of N copies of the
+// body. If two different modules share a name the later one is renamed. When a shape is appended
+// with AppendScad directly the body is written inline.
+Shape SCAD_WARN_UNUSED_RESULT Module(const std::string& name, const Shape& body);
+
 const char* BoolStr(bool b);
 void WriteIndent(std::FILE* file, int indent_level);
 void WriteComposite(std::FILE* file,
@@ -0,0 +1,197 @@
+#include "sweep.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cinttypes>
+#include <cstdlib>
+#include <memory>
+#include <random>
+#include <vector>
+
+#include "clearance.h"
+#include "interference.h"
+#include "key.h"
+#include "parallel.h"
+#include "scad.h"
+#include "trace.h"
+
+namespace scad {
+namespace {
+
+std::vector<SweepVariant> MakeVariants(const SweepParams& params) {
+  std::vector<SweepVariant> variants;
+  const std::vector<SweepAxis>& axes = params.axes;
+  auto names = std::make_shared<std::vector<std::string>>();
+  for (const SweepAxis& axis : axes) {
+    names->push_back(axis.name);
+  }
+  if (params.random_samples > 0) {
+    std::mt19937 random(params.seed);
+    for (int i = 0; i < params.random_samples; ++i) {
+      SweepVariant variant;
+      variant.index = i;
+      variant.axis_names = names;
+      for (const SweepAxis& axis : axes) {
+        auto bounds = std::minmax_element(axis.values.begin(), axis.values.end());
+        std::uniform_real_distribution<double> distribution(*bounds.first, *bounds.second);
+        variant.values.push_back(distribution(random));
+      }
+      variants.push_back(std::move(variant));
+    }
+    return variants;
+  }
+
+  size_t count = 1;
+  for (const SweepAxis& axis : axes) {
+    count *= axis.values.size();
+  }
+  for (size_t i = 0; i < count; ++i) {
+    SweepVariant variant;
+    variant.index = static_cast<int>(i);
+    variant.axis_names = names;
+    // The last axis changes fastest.
+    size_t rest = i;
+    variant.values.resize(axes.size());
+    for (size_t a = axes.size(); a-- > 0;) {
+      variant.values[a] = axes[a].values[rest % axes[a].values.size()];
+      rest /= axes[a].values.size();
+    }
+    variants.push_back(std::move(variant));
+  }
+  return variants;
+}
+
+uint64_t HashFnv1a(const std::string& text) {
+  uint64_t hash = 14695981039346656037ull;
+  for (char c : text) {
+    hash ^= static_cast<unsigned char>(c);
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+// Every axis needs at least one value, both to enumerate combinations and to bound samples.
+bool CheckParams(const SweepParams& params) {
+  if (params.random_samples < 0) {
+    fprintf(stderr, "Sweep random_samples must not be negative: %d\n", params.random_samples);
+    return false;
+  }
+  for (size_t i = 0; i < params.axes.size(); ++i) {
+    const SweepAxis& axis = params.axes[i];
+    if (axis.values.empty()) {
+      fprintf(stderr, "Sweep axis %s has no values\n", axis.name.c_str());
+      return false;
+    }
+    for (size_t j = 0; j < i; ++j) {
+      if (params.axes[j].name == axis.name) {
+        fprintf(stderr, "Sweep axis %s is listed twice\n", axis.name.c_str());
+        return false;
+      }
+    }
+  }
+  return true;
+}
+
+SweepMetrics Evaluate(const SweepVariant& variant, const SweepGenerator& generator) {
+  SCAD_TRACE_SCOPE_DETAIL("Sweep variant", std::to_string(variant.index));
+  auto start = std::chrono::steady_clock::now();
+  SweepMetrics metrics;
+  metrics.variant = variant;
+  SweepOutput output = generator(variant);
+
+  std::string scad = output.shape.ToScad();
+  metrics.output_hash = HashFnv1a(scad);
+  // The text was just written for the hash, so the hulls are counted without writing it again.
+  ShapeStats stats = output.shape.Stats(0, false);
+  metrics.hull_count = static_cast<int>(stats.kind_counts[static_cast<int>(ShapeKind::HULL)]);
+
+  std::vector<const Key*> keys;
+  bool first = true;
+  for (const Key& key : output.keys) {
+    keys.push_back(&key);
+    std::vector<glm::vec3> points = key.GetCapPoints();
+    const Mesh holder = MakeSwitchHolderMesh(key);
+    points.insert(points.end(), holder.points.begin(), holder.points.end());
+    for (const glm::vec3& p : points) {
+      metrics.min = first ? p : glm::min(metrics.min, p);
+      metrics.max = first ? p : glm::max(metrics.max, p);
+      first = false;
+    }
+  }
+  metrics.interference_count = static_cast<int>(FindInterferences(keys).size());
+
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  metrics.seconds = elapsed.count();
+  return metrics;
+}
+
+}  // namespace
+
+double SweepVariant::Get(const std::string& name) const {
+  for (size_t i = 0; axis_names && i < axis_names->size(); ++i) {
+    if ((*axis_names)[i] == name) {
+      return values[i];
+    }
+  }
+  // A misspelled axis would otherwise quietly sweep nothing, so stop here.
+  fprintf(stderr, "Unknown sweep axis: %s\n", name.c_str());
+  abort();
+}
+
+std::vector<SweepMetrics> RunSweep(const SweepParams& params, const SweepGenerator& generator) {
+  SCAD_TRACE_SCOPE("RunSweep");
+  if (!CheckParams(params)) {
+    return {};
+  }
+  std::vector<SweepVariant> variants = MakeVariants(params);
+  std::vector<SweepMetrics> results(variants.size());
+
+  // Variants are handed out one at a time since their cost varies a lot.
+  ParallelFor(variants.size(), params.num_threads, "RunSweep worker", [&](size_t i) {
+    results[i] = Evaluate(variants[i], generator);
+  });
+  return results;
+}
+
+void WriteSweepCsv(const std::vector<SweepMetrics>& metrics, std::FILE* file) {
+  fprintf(file, "index");
+  if (!metrics.empty() && metrics[0].variant.axis_names) {
+    for (const std::string& name : *metrics[0].variant.axis_names) {
+      fprintf(file, ",%s", name.c_str());
+    }
+  }
+  fprintf(file,
+          ",min_x,min_y,min_z,max_x,max_y,max_z,hull_count,interference_count,output_hash,"
+          "seconds\n");
+  for (const SweepMetrics& m : metrics) {
+    fprintf(file, "%d", m.variant.index);
+    for (double value : m.variant.values) {
+      fprintf(file, ",%g", value);
+    }
+    fprintf(file,
+            ",%.3f,%.3f,%.3f,%.3f,%.3f,%.3f,%d,%d,%016" PRIx64 ",%.4f\n",
+            m.min.x,
+            m.min.y,
+            m.min.z,
+            m.max.x,
+            m.max.y,
+            m.max.z,
+            m.hull_count,
+            m.interference_count,
+            m.output_hash,
+            m.seconds);
+  }
+}
+
+bool WriteSweepCsv(const std::vector<SweepMetrics>& metrics, const std::string& file_name) {
+  FILE* file = fopen(file_name.c_str(), "w");
+  if (!file) {
+    fprintf(stderr, "Unable to open %s\n", file_name.c_str());
+    return false;
+  }
+  WriteSweepCsv(metrics, file);
+  fclose(file);
+  return true;
+}
+
+}  // namespace scad
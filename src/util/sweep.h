@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <glm/glm.hpp>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "key.h"
+#include "scad.h"
+
+namespace scad {
+
+// One swept parameter (a spacing, a tilt angle, extra_z etc) and the values it takes.
+struct SweepAxis {
+  std::string name;
+  std::vector<double> values;
+};
+
+struct SweepParams {
+  std::vector<SweepAxis> axes;
+  // With zero every combination of the axis values is evaluated. Otherwise this many variants are
+  // sampled, each parameter uniformly between the smallest and largest of its values.
+  int random_samples = 0;
+  uint32_t seed = 1;
+  // Zero uses one thread per hardware thread.
+  int num_threads = 0;
+};
+
+// The parameter values of one variant, in the order of SweepParams::axes. The axis names are
+// shared by every variant of a sweep and stay valid after the SweepParams are gone.
+struct SweepVariant {
+  int index = 0;
+  std::vector<double> values;
+  std::shared_ptr<const std::vector<std::string>> axis_names;
+
+  // The value of the named axis. Aborts if the name is not one of the axes.
+  double Get(const std::string& name) const;
+};
+
+// What a generator makes for one variant. keys are used for the bounding box and the interference
+// check and may be left empty.
+struct SweepOutput {
+  Shape shape;
+  std::vector<Key> keys;
+};
+
+// Called from several threads at once, so it must not share mutable state (keys, nodes) between
+// calls.
+using SweepGenerator = std::function<SweepOutput(const SweepVariant& variant)>;
+
+struct SweepMetrics {
+  SweepVariant variant;
+  // Bounds of the key caps and switch holders.
+  glm::vec3 min = glm::vec3(0);
+  glm::vec3 max = glm::vec3(0);
+  int hull_count = 0;
+  int interference_count = 0;
+  // FNV-1a hash of the scad text of the shape, equal outputs hash the same.
+  uint64_t output_hash = 0;
+  double seconds = 0;
+};
+
+// Evaluates every variant on a pool of threads. Results are in variant order. Returns no results,
+// after printing why, if an axis has no values, two axes share a name or random_samples is
+// negative.
+std::vector<SweepMetrics> RunSweep(const SweepParams& params, const SweepGenerator& generator);
+
+// One row per variant with a column per axis followed by the metrics.
+void WriteSweepCsv(const std::vector<SweepMetrics>& metrics, std::FILE* file);
+bool WriteSweepCsv(const std::vector<SweepMetrics>& metrics, const std::string& file_name);
+
+}  // namespace scad
@@ -0,0 +1,178 @@
+#include "trace.h"
+
+#include <cstdio>
+
+#ifdef SCAD_TRACE_ENABLED
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+#endif
+
+namespace scad {
+
+#ifdef SCAD_TRACE_ENABLED
+
+namespace {
+
+struct TraceEvent {
+  const char* name;
+  std::string detail;
+  int64_t start_us;
+  int64_t duration_us;
+};
+
+// The events of one thread. Buffers are owned by the tracer rather than the thread so events of
+// threads which have exited (sweep and optimizer workers) are still written.
+struct ThreadBuffer {
+  int thread_id;
+  std::mutex mutex;
+  std::vector<TraceEvent> events;
+};
+
+class Tracer {
+ public:
+  static Tracer& Get() {
+    static Tracer* tracer = new Tracer();
+    return *tracer;
+  }
+
+  bool enabled() const {
+    return enabled_.load(std::memory_order_relaxed);
+  }
+
+  void Start() {
+    enabled_ = true;
+  }
+
+  int64_t NowUs() const {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now() - epoch_)
+        .count();
+  }
+
+  void Add(TraceEvent event) {
+    thread_local ThreadBuffer* buffer = nullptr;
+    if (buffer == nullptr) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      buffers_.push_back(std::make_unique<ThreadBuffer>());
+      buffer = buffers_.back().get();
+      buffer->thread_id = static_cast<int>(buffers_.size());
+    }
+    std::lock_guard<std::mutex> lock(buffer->mutex);
+    buffer->events.push_back(std::move(event));
+  }
+
+  bool Write(const std::string& file_name) {
+    enabled_ = false;
+    FILE* file = fopen(file_name.c_str(), "w");
+    if (!file) {
+      fprintf(stderr, "Unable to open %s\n", file_name.c_str());
+      return false;
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    fprintf(file, "{\"traceEvents\": [\n");
+    bool first = true;
+    for (const auto& buffer : buffers_) {
+      std::lock_guard<std::mutex> buffer_lock(buffer->mutex);
+      fprintf(file,
+              "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+              "\"args\": {\"name\": \"thread %d\"}}",
+              first ? "" : ",\n",
+              buffer->thread_id,
+              buffer->thread_id);
+      first = false;
+      for (const TraceEvent& event : buffer->events) {
+        fprintf(file, ",\n{\"name\": ");
+        WriteString(file, event.name);
+        fprintf(file,
+                ", \"ph\": \"X\", \"pid\": 1, \"tid\": %d, \"ts\": %lld, \"dur\": %lld",
+                buffer->thread_id,
+                static_cast<long long>(event.start_us),
+                static_cast<long long>(event.duration_us));
+        if (!event.detail.empty()) {
+          fprintf(file, ", \"args\": {\"detail\": ");
+          WriteString(file, event.detail);
+          fprintf(file, "}");
+        }
+        fprintf(file, "}");
+      }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return true;
+  }
+
+ private:
+  Tracer() : epoch_(std::chrono::steady_clock::now()) {
+  }
+
+  static void WriteString(FILE* file, const std::string& text) {
+    fputc('"', file);
+    for (unsigned char c : text) {
+      if (c == '"' || c == '\\') {
+        fprintf(file, "\\%c", c);
+      } else if (c < 0x20) {
+        fprintf(file, "\\u%04x", c);
+      } else {
+        fputc(c, file);
+      }
+    }
+    fputc('"', file);
+  }
+
+  std::atomic<bool> enabled_{false};
+  const std::chrono::steady_clock::time_point epoch_;
+  std::mutex mutex_;
+  std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+};
+
+}  // namespace
+
+TraceScope::TraceScope(const char* name, std::string detail)
+    : name_(name), detail_(std::move(detail)) {
+  if (Tracer::Get().enabled()) {
+    start_us_ = Tracer::Get().NowUs();
+  }
+}
+
+TraceScope::~TraceScope() {
+  if (start_us_ < 0) {
+    return;
+  }
+  Tracer& tracer = Tracer::Get();
+  tracer.Add({name_, std::move(detail_), start_us_, tracer.NowUs() - start_us_});
+}
+
+void StartTracing() {
+  Tracer::Get().Start();
+}
+
+bool TracingStarted() {
+  return Tracer::Get().enabled();
+}
+
+bool WriteTrace(const std::string& file_name) {
+  return Tracer::Get().Write(file_name);
+}
+
+#else
+
+void StartTracing() {
+}
+
+bool TracingStarted() {
+  return false;
+}
+
+bool WriteTrace(const std::string& file_name) {
+  fprintf(stderr,
+          "Not writing %s, tracing is compiled out (build with -DSCAD_TRACE=ON)\n",
+          file_name.c_str());
+  return false;
+}
+
+#endif
+
+}  // namespace scad
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+// Scoped timing of generation phases, written as Chrome trace event JSON which chrome://tracing
+// and Perfetto show as a timeline per thread. Scopes are only compiled in when building with
+// -DSCAD_TRACE=ON, otherwise SCAD_TRACE_SCOPE expands to nothing.
+//
+//   void BuildThing() {
+//     SCAD_TRACE_SCOPE("BuildThing");
+//     ...
+//   }
+
+namespace scad {
+
+#ifdef SCAD_TRACE_ENABLED
+
+// Records the time from construction to destruction as one event on the current thread, if tracing
+// was started. name must outlive the trace, detail is shown as an argument of the event.
+// SCAD_TRACE_SCOPE_DETAIL only evaluates its detail expression once tracing has started, so
+// building the string costs nothing in untraced runs.
+class TraceScope {
+ public:
+  explicit TraceScope(const char* name, std::string detail = "");
+  ~TraceScope();
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+ private:
+  const char* name_;
+  std::string detail_;
+  int64_t start_us_ = -1;
+};
+
+#define SCAD_TRACE_CONCAT_INNER(a, b) a##b
+#define SCAD_TRACE_CONCAT(a, b) SCAD_TRACE_CONCAT_INNER(a, b)
+#define SCAD_TRACE_SCOPE(name) \
+  ::scad::TraceScope SCAD_TRACE_CONCAT(scad_trace_scope_, __LINE__)(name)
+#define SCAD_TRACE_SCOPE_DETAIL(name, detail)                               \
+  ::scad::TraceScope SCAD_TRACE_CONCAT(scad_trace_scope_, __LINE__)(        \
+      name, ::scad::TracingStarted() ? std::string(detail) : std::string())
+
+#else
+
+#define SCAD_TRACE_SCOPE(name)
+#define SCAD_TRACE_SCOPE_DETAIL(name, detail)
+
+#endif
+
+// Starts recording scopes on every thread. Does nothing when tracing is compiled out.
+void StartTracing();
+
+// Whether StartTracing has been called. Always false when tracing is compiled out.
+bool TracingStarted();
+
+// Stops recording and writes the events recorded so far. Returns false if tracing is compiled out
+// or the file could not be written.
+bool WriteTrace(const std::string& file_name);
+
+}  // namespace scad
@@ -1,22 +1,69 @@
 #include "transform.h"
 
 #include <glm/glm.hpp>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
 #include <glm/gtc/matrix_transform.hpp>
 #include <vector>
 
 #include "scad.h"
+#include "trace.h"
 
 namespace scad {
+namespace {
+
+// Versions are unique across all nodes so a reparented node can never match a stale version.
+uint64_t NextVersion() {
+  static std::atomic<uint64_t> version(0);
+  return ++version;
+}
+
+// Held while any node changes its parent, so the cycle check and the change are one step and the
+// parents it walks can not change under it.
+std::mutex& ParentMutex() {
+  static std::mutex mutex;
+  return mutex;
+}
+
+}  // namespace
 
 glm::vec3 Transform::Apply(const glm::vec3& p) const {
+  glm::vec4 transformed = GetMatrix() * glm::vec4(p.x, p.y, p.z, 1);
+  return glm::vec3(transformed.x, transformed.y, transformed.z);
+}
+
+glm::mat4 Transform::GetMatrix() const {
   glm::mat4 transform(1.0f);
   transform = glm::translate(transform, translation());
   transform = glm::rotate(transform, glm::radians((float)ry), glm::vec3(0, 1, 0));
   transform = glm::rotate(transform, glm::radians((float)rx), glm::vec3(1, 0, 0));
   transform = glm::rotate(transform, glm::radians((float)rz), glm::vec3(0, 0, 1));
+  return transform;
+}
 
-  glm::vec4 transformed = transform * glm::vec4(p.x, p.y, p.z, 1);
-  return glm::vec3(transformed.x, transformed.y, transformed.z);
+glm::mat4 Transform::GetInverseMatrix() const {
+  glm::mat3 rotation_inverse = glm::transpose(glm::mat3(GetMatrix()));
+  glm::mat4 inverse(rotation_inverse);
+  inverse[3] = glm::vec4(rotation_inverse * (-1.0f * translation()), 1);
+  return inverse;
+}
+
+TransformList Transform::Inverse() const {
+  TransformList transforms;
+  if (x != 0 || y != 0 || z != 0) {
+    transforms.AddTransform({-1 * x, -1 * y, -1 * z});
+  }
+  if (ry != 0) {
+    transforms.AddTransform(Rotation(0, -1 * ry, 0));
+  }
+  if (rx != 0) {
+    transforms.AddTransform(Rotation(-1 * rx, 0, 0));
+  }
+  if (rz != 0) {
+    transforms.AddTransform(Rotation(0, 0, -1 * rz));
+  }
+  return transforms;
 }
 
 Shape TransformList::Apply(const Shape& in) const {
@@ -35,4 +82,95 @@ glm::vec3 TransformList::Apply(const glm::vec3& in) const {
   return point;
 }
 
+glm::mat4 TransformList::GetMatrix() const {
+  glm::mat4 matrix(1.0f);
+  for (auto& transform : transforms_) {
+    matrix = transform.GetMatrix() * matrix;
+  }
+  return matrix;
+}
+
+glm::mat4 TransformList::GetInverseMatrix() const {
+  glm::mat4 matrix(1.0f);
+  for (auto& transform : transforms_) {
+    matrix = matrix * transform.GetInverseMatrix();
+  }
+  return matrix;
+}
+
+TransformList TransformList::Inverse() const {
+  TransformList inverse;
+  for (auto it = transforms_.rbegin(); it != transforms_.rend(); ++it) {
+    inverse.Append(it->Inverse());
+  }
+  return inverse;
+}
+
+std::shared_ptr<TransformNode> TransformNode::Create(TransformList transforms,
+                                                     std::shared_ptr<const TransformNode> parent) {
+  return std::make_shared<TransformNode>(std::move(transforms), std::move(parent));
+}
+
+TransformNode::TransformNode(TransformList transforms, std::shared_ptr<const TransformNode> parent)
+    : transforms_(std::move(transforms)), local_version_(NextVersion()) {
+  SetParent(std::move(parent));
+}
+
+void TransformNode::SetTransforms(TransformList transforms) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  transforms_ = std::move(transforms);
+  local_version_ = NextVersion();
+}
+
+void TransformNode::Configure(const std::function<void(TransformList& transforms)>& fn) {
+  std::lock_guard<std::mutex> lock(mutex_);
+  fn(transforms_);
+  local_version_ = NextVersion();
+}
+
+bool TransformNode::SetParent(std::shared_ptr<const TransformNode> parent) {
+  std::lock_guard<std::mutex> parent_lock(ParentMutex());
+  // parent_ only changes under ParentMutex, and parent keeps its ancestors alive, so the chain can
+  // be walked without locking each node.
+  for (const TransformNode* node = parent.get(); node; node = node->parent_.get()) {
+    if (node == this) {
+      fprintf(stderr, "TransformNode parent would create a cycle, keeping the current parent\n");
+      return false;
+    }
+  }
+  std::lock_guard<std::mutex> lock(mutex_);
+  parent_ = std::move(parent);
+  local_version_ = NextVersion();
+  return true;
+}
+
+void TransformNode::Resolve() const {
+  uint64_t parent_version = parent_ ? parent_->GetWorldVersion() : 0;
+  if (resolved_ && resolved_local_version_ == local_version_ &&
+      resolved_parent_version_ == parent_version) {
+    return;
+  }
+  SCAD_TRACE_SCOPE("TransformNode::Resolve");
+  world_transforms_ = transforms_;
+  if (parent_) {
+    world_transforms_.Append(parent_->GetWorldTransforms());
+  }
+  resolved_local_version_ = local_version_;
+  resolved_parent_version_ = parent_version;
+  world_version_ = NextVersion();
+  resolved_ = true;
+}
+
+TransformList TransformNode::GetWorldTransforms() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Resolve();
+  return world_transforms_;
+}
+
+uint64_t TransformNode::GetWorldVersion() const {
+  std::lock_guard<std::mutex> lock(mutex_);
+  Resolve();
+  return world_version_;
+}
+
 }  // namespace scad
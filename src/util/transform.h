@@ -1,14 +1,21 @@
 #pragma once
 
+#include <cstdint>
+#include <functional>
 #include <glm/glm.hpp>
+#include <memory>
+#include <mutex>
 #include <vector>
 
+#include "alloc_stats.h"
 #include "scad.h"
 
 namespace scad {
 
 const glm::vec3 kOrigin(0, 0, 0);
 
+class TransformList;
+
 // A rotation and translation. The rotations are applied first in z,x,y order and then the
 // translation is added.
 struct Transform {
@@ -50,6 +57,15 @@ struct Transform {
     return glm::vec3(x, y, z);
   }
 
+  bool operator==(const Transform& other) const {
+    return x == other.x && y == other.y && z == other.z && rx == other.rx && ry == other.ry &&
+           rz == other.rz;
+  }
+
+  bool operator!=(const Transform& other) const {
+    return !(*this == other);
+  }
+
   Transform& SetRotationX(double rotation) {
     rx = rotation;
     return *this;
@@ -90,6 +106,15 @@ struct Transform {
   }
 
   glm::vec3 Apply(const glm::vec3& p) const;
+
+  // The matrix which applies this transform to a point.
+  glm::mat4 GetMatrix() const;
+  // The exact inverse of GetMatrix. The rotation part is orthonormal so it is transposed instead of
+  // using a general matrix inverse.
+  glm::mat4 GetInverseMatrix() const;
+  // The transforms that undo this one. This can't be a single Transform since the translation has
+  // to be removed first and the rotations undone in y,x,z order.
+  TransformList Inverse() const;
 };
 
 // A list of transforms to apply to a shape or a point. The transforms are applied in order. If you
@@ -100,6 +125,12 @@ class TransformList {
   Shape Apply(const Shape& shape) const;
   glm::vec3 Apply(const glm::vec3& p) const;
 
+  // A single matrix equivalent to applying every transform in order.
+  glm::mat4 GetMatrix() const;
+  glm::mat4 GetInverseMatrix() const;
+  // Applying the result after this list returns every point and shape to where it started.
+  TransformList Inverse() const;
+
   Transform& AddTransform(Transform t = {}) {
     transforms_.push_back(t);
     return transforms_.back();
@@ -114,6 +145,14 @@ class TransformList {
     return transforms_.empty();
   }
 
+  bool operator==(const TransformList& other) const {
+    return transforms_ == other.transforms_;
+  }
+
+  bool operator!=(const TransformList& other) const {
+    return !(*this == other);
+  }
+
   Transform& mutable_front() {
     if (empty()) {
       return AddTransform();
@@ -181,7 +220,58 @@ class TransformList {
   }
 
  private:
-  std::vector<Transform> transforms_;
+  std::vector<Transform, AccountedAllocator<Transform, AllocationCategory::TRANSFORM_LIST>>
+      transforms_;
+};
+
+// A node in a hierarchy of transforms such as a column or a thumb cluster which keys are attached
+// to (see Key::SetParent). Moving a node moves everything below it. World transforms are resolved
+// lazily and only recomputed for nodes whose own transforms or whose ancestors' transforms changed
+// since they were last read. Nodes may be changed while other threads read them; transforms() and
+// parent() return references though, so they should only be used while no one changes the node.
+class TransformNode {
+ public:
+  static std::shared_ptr<TransformNode> Create(
+      TransformList transforms = {}, std::shared_ptr<const TransformNode> parent = nullptr);
+
+  TransformNode(TransformList transforms, std::shared_ptr<const TransformNode> parent);
+  TransformNode(const TransformNode&) = delete;
+  TransformNode& operator=(const TransformNode&) = delete;
+
+  const TransformList& transforms() const {
+    return transforms_;
+  }
+  void SetTransforms(TransformList transforms);
+  // Edits the local transforms in place. fn runs under the node's lock so it must not use the node.
+  void Configure(const std::function<void(TransformList& transforms)>& fn);
+
+  const std::shared_ptr<const TransformNode>& parent() const {
+    return parent_;
+  }
+  // Refuses a parent which has this node as an ancestor, returning false and keeping the current
+  // parent. Parent changes on all nodes are serialized, so concurrent calls can not build a cycle
+  // between them.
+  bool SetParent(std::shared_ptr<const TransformNode> parent);
+
+  // The local transforms followed by those of every ancestor.
+  TransformList GetWorldTransforms() const;
+  // Changes every time the world transforms of this node change. Can be stored by anything derived
+  // from this node to tell whether it needs to be rebuilt.
+  uint64_t GetWorldVersion() const;
+
+ private:
+  void Resolve() const;
+
+  TransformList transforms_;
+  std::shared_ptr<const TransformNode> parent_;
+  uint64_t local_version_;
+
+  mutable std::mutex mutex_;
+  mutable bool resolved_ = false;
+  mutable uint64_t resolved_local_version_ = 0;
+  mutable uint64_t resolved_parent_version_ = 0;
+  mutable uint64_t world_version_ = 0;
+  mutable TransformList world_transforms_;
 };
 
 }  // namespace scad